@@ -1,4 +1,14 @@
 #include <assert.h>
+#include <string.h>
+
+#include <atomic>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 extern "C" {
 #define __STDC_CONSTANT_MACROS
@@ -10,17 +20,48 @@ extern "C" {
 }
 
 #include "spek-audio.h"
+#include "spek-pcm.h"
+#include "spek-utils.h"
+
+enum
+{
+    SEEK_PREROLL = 8192, // Frames decoded and dropped before the target of a seek.
+    PCM_READ_FRAMES = 1 << 14, // Frames per read() of plain PCM.
+    PCM_PREFETCH = 1 << 22, // Bytes of plain PCM paged in after a seek.
+};
+
+// With `like` set, the file is opened again the way `like` was: the same input format and what
+// avformat_find_stream_info() found out, so that nothing has to be probed.
+static std::unique_ptr<AudioFile> open_file(
+    const std::string& file_name, const std::string& device_name, int stream, bool dump,
+    const AVFormatContext *like);
+static bool copy_stream_info(AVFormatContext *to, const AVFormatContext *from);
+
+// Converts `n` frames starting at `skip` of `planes` channels starting at `channel` into
+// consecutive planes of floats. One is picked per sample format, see get_converter().
+typedef void (*converter)(
+    float *out, uint8_t *const *data, int skip, int n, int channels, int channel, int planes);
+static converter get_converter(AVSampleFormat format);
+// Reads the samples of `format` straight from the file, nullptr if there is no converter.
+static converter get_pcm_converter(const PcmFormat& format);
+static std::unique_ptr<AudioFile> open_pcm(const std::string& file_name);
 
 class AudioFileImpl : public AudioFile
 {
 public:
     AudioFileImpl(
-        AudioError error, AVFormatContext *format_context, int audio_stream,
-        const std::string& codec_name, int bit_rate, int sample_rate, int bits_per_sample,
-        int streams, int channels, double duration
+        const std::string& file_name, const std::string& device_name, int stream,
+        AudioError error, AVFormatContext *format_context, AVCodecContext *codec_context,
+        int audio_stream, const std::string& codec_name, int bit_rate, int sample_rate,
+        int bits_per_sample, int streams, int channels, double duration
     );
     ~AudioFileImpl() override;
+    std::unique_ptr<AudioFile> reopen() const override;
+    bool rewind() override;
+    void interrupt() override { this->interrupted = true; }
     void start(int channel, int samples) override;
+    void start_live(int channel, int frames) override;
+    void seek(int64_t frame) override;
     int read() override;
 
     AudioError get_error() const override { return this->error; }
@@ -31,14 +72,21 @@ public:
     int get_streams() const override { return this->streams; }
     int get_channels() const override { return this->channels; }
     double get_duration() const override { return this->duration; }
-    const float *get_buffer() const override { return this->buffer; }
+    const float *get_plane(int plane) const override { return this->planes[plane]; }
     int64_t get_frames_per_interval() const override { return this->frames_per_interval; }
     int64_t get_error_per_interval() const override { return this->error_per_interval; }
     int64_t get_error_base() const override { return this->error_base; }
+    AudioTimes get_times() const override { return this->times; }
 
 private:
+    static int interrupt_cb(void *opaque);
+
+    std::string file_name;
+    std::string device_name;
+    int stream;
     AudioError error;
     AVFormatContext *format_context;
+    AVCodecContext *codec_context;
     int audio_stream;
     std::string codec_name;
     int bit_rate;
@@ -50,58 +98,146 @@ private:
 
     int channel;
 
-    AVPacket packet;
-    int offset;
-    AVFrame *frame;
+    std::atomic<bool> interrupted; // Checked by FFmpeg whenever it blocks on the file.
+    AVPacket *packet;
+    bool draining; // The end of the stream was sent to the decoder.
+    AVFrame *frame; // Referenced until the next read(), `planes` may point into it.
+    int64_t position; // The frame the next decoded samples start at, -1 if unknown.
+    int64_t seek_frame; // Samples before this one are dropped.
     int buffer_len;
-    float *buffer;
+    float *buffer; // Converted samples, for formats that are not float already.
+    std::vector<const float*> planes;
+    AudioTimes times;
     // TODO: these guys don't belong here, move them somewhere else when revamping the pipeline
     int64_t frames_per_interval;
     int64_t error_per_interval;
     int64_t error_base;
 };
 
+// Uncompressed WAV and AIFF, converted straight from a mapping of the file instead of going
+// through a demuxer and decoder. Seeking is exact.
+class PcmAudioFile : public AudioFile
+{
+public:
+    PcmAudioFile(
+        const std::string& file_name, std::shared_ptr<const PcmMapping> mapping, const PcmFormat& format
+    );
+    std::unique_ptr<AudioFile> reopen() const override;
+    bool rewind() override;
+    void interrupt() override { this->interrupted = true; }
+    void start(int channel, int samples) override;
+    void start_live(int channel, int frames) override;
+    void seek(int64_t frame) override;
+    int read() override;
+
+    AudioError get_error() const override { return this->error; }
+    std::string get_codec_name() const override;
+    int get_bit_rate() const override { return 0; }
+    int get_sample_rate() const override { return this->format.sample_rate; }
+    int get_bits_per_sample() const override { return this->format.bits; }
+    int get_streams() const override { return 1; }
+    int get_channels() const override { return this->format.channels; }
+    double get_duration() const override { return this->format.frames / (double)this->format.sample_rate; }
+    const float *get_plane(int plane) const override { return this->planes[plane]; }
+    int64_t get_frames_per_interval() const override { return this->frames_per_interval; }
+    int64_t get_error_per_interval() const override { return this->error_per_interval; }
+    int64_t get_error_base() const override { return this->error_base; }
+    AudioTimes get_times() const override { return this->times; }
+
+private:
+    std::string file_name;
+    std::shared_ptr<const PcmMapping> mapping;
+    PcmFormat format;
+    converter convert;
+    AudioError error;
+    int channel;
+
+    std::atomic<bool> interrupted;
+    int64_t position; // The frame the next read() starts at.
+    std::vector<float> buffer;
+    std::vector<const float*> planes;
+    AudioTimes times;
+    int64_t frames_per_interval;
+    int64_t error_per_interval;
+    int64_t error_base;
+};
+
 
-Audio::Audio()
+Audio::Audio(bool dump_format) : dump_format(dump_format)
 {
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
     av_register_all();
+#endif
+    avdevice_register_all();
 }
 
 Audio::~Audio()
 {
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 9, 100)
     // This prevents a memory leak.
     av_lockmgr_register(nullptr);
+#endif
 }
 
 std::unique_ptr<AudioFile> Audio::open(const std::string& file_name, const std::string& device_name, int stream)
 {
-    AudioError error = AudioError::OK;
+    // Plain PCM doesn't need FFmpeg, unless it's asked what it makes of the file.
+    if (device_name.empty() && !stream && !this->dump_format) {
+        auto file = open_pcm(file_name);
+        if (file) {
+            return file;
+        }
+    }
+    return open_file(file_name, device_name, stream, this->dump_format, nullptr);
+}
 
-    static bool registered;
-    if (!registered) {
-        avdevice_register_all();
-        registered = true;
+static std::unique_ptr<AudioFile> open_pcm(const std::string& file_name)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // The converters take the samples as they are in memory.
+    (void)file_name;
+    return nullptr;
+#else
+    auto mapping = PcmMapping::open(file_name);
+    PcmFormat format;
+    if (!mapping || !spek_pcm_parse(mapping->get_data(), mapping->get_size(), &format) ||
+        !get_pcm_converter(format)) {
+        return nullptr;
     }
+    return std::unique_ptr<AudioFile>(new PcmAudioFile(file_name, mapping, format));
+#endif
+}
+
+static std::unique_ptr<AudioFile> open_file(
+    const std::string& file_name, const std::string& device_name, int stream, bool dump,
+    const AVFormatContext *like)
+{
+    AudioError error = AudioError::OK;
 
     const char* file_or_device = file_name.c_str();
-    AVInputFormat *file_iformat = nullptr;
+    const AVInputFormat *file_iformat = nullptr;
     if (!device_name.empty()) {
         file_or_device = "default";
         file_iformat = av_find_input_format("alsa");
         if (!file_iformat) {
             error = AudioError::CANNOT_OPEN_DEVICE;
-        } else {
         }
+    } else if (like) {
+        file_iformat = like->iformat;
     }
 
     AVFormatContext *format_context = nullptr;
     if (!error) {
-        if (avformat_open_input(&format_context, file_or_device, file_iformat, nullptr) != 0) {
+        // Before FFmpeg 5 the format isn't const.
+        AVInputFormat *iformat = const_cast<AVInputFormat *>(file_iformat);
+        if (avformat_open_input(&format_context, file_or_device, iformat, nullptr) != 0) {
             error = AudioError::CANNOT_OPEN_FILE;
         }
     }
 
-    if (!error && avformat_find_stream_info(format_context, nullptr) < 0) {
+    // Finding the stream info may read far into the file, don't do it twice.
+    bool copied = !error && like && copy_stream_info(format_context, like);
+    if (!error && !copied && avformat_find_stream_info(format_context, nullptr) < 0) {
         // 24-bit APE returns an error but parses the stream info just fine.
         // TODO: old comment, verify
         if (format_context->nb_streams <= 0) {
@@ -113,7 +249,7 @@ std::unique_ptr<AudioFile> Audio::open(const std::string& file_name, const std::
     int streams = 0;
     if (!error) {
         for (unsigned int i = 0; i < format_context->nb_streams; i++) {
-            if (format_context->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
+            if (format_context->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
                 if (stream == streams) {
                     audio_stream = i;
                 }
@@ -127,15 +263,20 @@ std::unique_ptr<AudioFile> Audio::open(const std::string& file_name, const std::
 
     AVStream *avstream = nullptr;
     AVCodecContext *codec_context = nullptr;
-    AVCodec *codec = nullptr;
+    const AVCodec *codec = nullptr;
     if (!error) {
         avstream = format_context->streams[audio_stream];
-        codec_context = avstream->codec;
-        codec = avcodec_find_decoder(codec_context->codec_id);
+        codec = avcodec_find_decoder(avstream->codecpar->codec_id);
         if (!codec) {
             error = AudioError::NO_DECODER;
         }
     }
+    if (!error) {
+        codec_context = avcodec_alloc_context3(codec);
+        if (!codec_context || avcodec_parameters_to_context(codec_context, avstream->codecpar) < 0) {
+            error = AudioError::CANNOT_OPEN_DECODER;
+        }
+    }
 
     std::string codec_name;
     int bit_rate = 0;
@@ -163,15 +304,17 @@ std::unique_ptr<AudioFile> Audio::open(const std::string& file_name, const std::
         if (bits_per_sample) {
             bit_rate = 0;
         }
-        channels = codec_context->channels;
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
+        channels = avstream->codecpar->ch_layout.nb_channels;
+#else
+        channels = avstream->codecpar->channels;
+#endif
 
         if (avstream->duration != AV_NOPTS_VALUE) {
             duration = avstream->duration * av_q2d(avstream->time_base);
         } else if (format_context->duration != AV_NOPTS_VALUE) {
             duration = format_context->duration / (double) AV_TIME_BASE;
-        } else if (!device_name.empty()) {
-            duration = 60; /* seconds visible */
-        } else {
+        } else if (device_name.empty()) {
             error = AudioError::NO_DURATION;
         }
 
@@ -194,34 +337,71 @@ std::unique_ptr<AudioFile> Audio::open(const std::string& file_name, const std::
         }
     }
 
-    if (format_context) {
+    if (format_context && dump) {
         av_dump_format(format_context, 0, file_name.c_str(), false);
     }
 
     return std::unique_ptr<AudioFile>(new AudioFileImpl(
-        error, format_context, audio_stream,
+        file_name, device_name, stream, error, format_context, codec_context, audio_stream,
         codec_name, bit_rate, sample_rate, bits_per_sample,
         streams, channels, duration
     ));
 }
 
+// Returns false if the streams of `to` don't match those of `from`, e.g. when they are only
+// found by reading the file, avformat_find_stream_info() has to run then.
+static bool copy_stream_info(AVFormatContext *to, const AVFormatContext *from)
+{
+    if (to->nb_streams != from->nb_streams) {
+        return false;
+    }
+    for (unsigned int i = 0; i < to->nb_streams; i++) {
+        const AVStream *src = from->streams[i];
+        const AVStream *dst = to->streams[i];
+        if (dst->codecpar->codec_type != src->codecpar->codec_type ||
+            av_cmp_q(dst->time_base, src->time_base) != 0) {
+            return false;
+        }
+    }
+    for (unsigned int i = 0; i < to->nb_streams; i++) {
+        const AVStream *src = from->streams[i];
+        AVStream *dst = to->streams[i];
+        if (avcodec_parameters_copy(dst->codecpar, src->codecpar) < 0) {
+            return false;
+        }
+        dst->start_time = src->start_time;
+        dst->duration = src->duration;
+    }
+    to->duration = from->duration;
+    return true;
+}
+
 AudioFileImpl::AudioFileImpl(
-    AudioError error, AVFormatContext *format_context, int audio_stream,
-    const std::string& codec_name, int bit_rate, int sample_rate, int bits_per_sample,
-    int streams, int channels, double duration
+    const std::string& file_name, const std::string& device_name, int stream,
+    AudioError error, AVFormatContext *format_context, AVCodecContext *codec_context,
+    int audio_stream, const std::string& codec_name, int bit_rate, int sample_rate,
+    int bits_per_sample, int streams, int channels, double duration
 ) :
-    error(error), format_context(format_context), audio_stream(audio_stream),
+    file_name(file_name), device_name(device_name), stream(stream),
+    error(error), format_context(format_context), codec_context(codec_context),
+    audio_stream(audio_stream),
     codec_name(codec_name), bit_rate(bit_rate),
     sample_rate(sample_rate), bits_per_sample(bits_per_sample),
     streams(streams), channels(channels), duration(duration)
 {
-    av_init_packet(&this->packet);
-    this->packet.data = nullptr;
-    this->packet.size = 0;
-    this->offset = 0;
+    this->interrupted = false;
+    if (this->format_context) {
+        this->format_context->interrupt_callback.callback = &AudioFileImpl::interrupt_cb;
+        this->format_context->interrupt_callback.opaque = this;
+    }
+    this->packet = av_packet_alloc();
+    this->draining = false;
     this->frame = av_frame_alloc();
+    this->position = 0;
+    this->seek_frame = 0;
     this->buffer_len = 0;
     this->buffer = nullptr;
+    this->times = AudioTimes();
     this->frames_per_interval = 0;
     this->error_per_interval = 0;
     this->error_base = 0;
@@ -235,30 +415,59 @@ AudioFileImpl::~AudioFileImpl()
     if (this->frame) {
         av_frame_free(&this->frame);
     }
-    if (this->packet.data) {
-        this->packet.data -= this->offset;
-        this->packet.size += this->offset;
-        this->offset = 0;
-        av_packet_unref(&this->packet);
+    if (this->packet) {
+        av_packet_free(&this->packet);
+    }
+    if (this->codec_context) {
+        avcodec_free_context(&this->codec_context);
     }
     if (this->format_context) {
-        if (this->audio_stream >= 0) {
-            auto codec_context = this->format_context->streams[this->audio_stream]->codec;
-            if (codec_context) {
-                avcodec_close(codec_context);
-            }
-        }
         avformat_close_input(&this->format_context);
     }
 }
 
+std::unique_ptr<AudioFile> AudioFileImpl::reopen() const
+{
+    // Live input can only be read once.
+    if (!this->device_name.empty()) {
+        return nullptr;
+    }
+    return open_file(this->file_name, this->device_name, this->stream, false, this->format_context);
+}
+
+int AudioFileImpl::interrupt_cb(void *opaque)
+{
+    return static_cast<AudioFileImpl*>(opaque)->interrupted ? 1 : 0;
+}
+
+bool AudioFileImpl::rewind()
+{
+    // The demuxer may be anywhere after an interrupted read, don't trust it.
+    if (!!this->error || !this->device_name.empty() || this->interrupted) {
+        return false;
+    }
+    AVStream *stream = this->format_context->streams[this->audio_stream];
+    int64_t timestamp = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    if (av_seek_frame(this->format_context, this->audio_stream, timestamp, AVSEEK_FLAG_BACKWARD) < 0) {
+        return false;
+    }
+    avcodec_flush_buffers(this->codec_context);
+    this->draining = false;
+    this->position = -1;
+    this->seek_frame = 0;
+    return true;
+}
+
 void AudioFileImpl::start(int channel, int samples)
 {
     this->channel = channel;
-    if (channel < 0 || channel >= this->channels) {
+    if (channel < AUDIO_ALL_CHANNELS || channel >= this->channels) {
         assert(false);
         this->error = AudioError::NO_CHANNELS;
     }
+    if (!!this->error) {
+        return;
+    }
 
     AVStream *stream = this->format_context->streams[this->audio_stream];
     int64_t rate = this->sample_rate * (int64_t)stream->time_base.num;
@@ -268,95 +477,447 @@ void AudioFileImpl::start(int channel, int samples)
     this->error_per_interval = (duration * rate) % this->error_base;
 }
 
-int AudioFileImpl::read()
+void AudioFileImpl::start_live(int channel, int frames)
+{
+    start(channel, 1);
+    this->frames_per_interval = frames;
+    this->error_per_interval = 0;
+    this->error_base = 1;
+}
+
+void AudioFileImpl::seek(int64_t frame)
 {
     if (!!this->error) {
+        return;
+    }
+
+    // Land on the closest point a little before `frame`, so that decoders which depend
+    // on previous packets have settled by then. The rest is decoded and dropped.
+    AVStream *stream = this->format_context->streams[this->audio_stream];
+    if (frame < this->position || frame > this->position + this->sample_rate) {
+        int64_t timestamp = av_rescale_q(
+            spek_max64(0, frame - SEEK_PREROLL), AVRational{1, this->sample_rate}, stream->time_base
+        );
+        if (stream->start_time != AV_NOPTS_VALUE) {
+            timestamp += stream->start_time;
+        }
+        if (av_seek_frame(this->format_context, this->audio_stream, timestamp, AVSEEK_FLAG_BACKWARD) >= 0) {
+            avcodec_flush_buffers(this->codec_context);
+            this->draining = false;
+            this->position = -1;
+        }
+    }
+    this->seek_frame = frame;
+}
+
+int AudioFileImpl::read()
+{
+    if (!!this->error || this->interrupted) {
         return -1;
     }
 
     for (;;) {
-        while (this->packet.size > 0) {
-            av_frame_unref(this->frame);
-            auto codec_context = this->format_context->streams[this->audio_stream]->codec;
-            int got_frame = 0;
-            int len = avcodec_decode_audio4(codec_context, this->frame, &got_frame, &this->packet);
-            if (len < 0) {
-                // Error, skip the frame.
-                break;
+        // The decoder unreferences the previous frame, `planes` may point into it.
+        int64_t start = spek_now();
+        int res = avcodec_receive_frame(this->codec_context, this->frame);
+        this->times.decode += spek_now() - start;
+        if (res == AVERROR(EAGAIN)) {
+            // Feed it another packet, or the end of the stream to get the rest.
+            if (this->draining) {
+                return 0;
             }
-            this->packet.data += len;
-            this->packet.size -= len;
-            this->offset += len;
-            if (!got_frame) {
-                // No data yet, get more frames.
-                continue;
+            start = spek_now();
+            while ((res = av_read_frame(this->format_context, this->packet)) >= 0) {
+                if (this->packet->stream_index == this->audio_stream) {
+                    break;
+                }
+                av_packet_unref(this->packet);
             }
-            // We have data, return it and come back for more later.
-            int samples = this->frame->nb_samples;
-            if (samples > this->buffer_len) {
-                this->buffer = static_cast<float*>(
-                    av_realloc(this->buffer, samples * sizeof(float))
-                );
-                this->buffer_len = samples;
+            int64_t demuxed = spek_now();
+            this->times.demux += demuxed - start;
+            if (res < 0) {
+                // End of file or error.
+                this->draining = true;
+                avcodec_send_packet(this->codec_context, nullptr);
+            } else {
+                // Broken packets are skipped.
+                avcodec_send_packet(this->codec_context, this->packet);
+                av_packet_unref(this->packet);
             }
+            this->times.decode += spek_now() - demuxed;
+            continue;
+        }
+        if (res == AVERROR_EOF) {
+            return 0;
+        }
+        if (res < 0) {
+            // Error, skip the frame.
+            continue;
+        }
 
-            AVSampleFormat format = static_cast<AVSampleFormat>(this->frame->format);
-            int is_planar = av_sample_fmt_is_planar(format);
-            for (int sample = 0; sample < samples; ++sample) {
-                uint8_t *data;
-                int offset;
-                if (is_planar) {
-                    data = this->frame->data[this->channel];
-                    offset = sample;
-                } else {
-                    data = this->frame->data[0];
-                    offset = sample * this->channels;
+        // Work out where a seek has landed from the first timestamp after it.
+        AVStream *stream = this->format_context->streams[this->audio_stream];
+        if (this->position < 0) {
+            int64_t timestamp = this->frame->best_effort_timestamp;
+            if (timestamp == AV_NOPTS_VALUE) {
+                this->position = this->seek_frame;
+            } else {
+                if (stream->start_time != AV_NOPTS_VALUE) {
+                    timestamp -= stream->start_time;
                 }
-                float value;
-                switch (format) {
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P:
-                    value = reinterpret_cast<int16_t*>(data)[offset]
-                        / static_cast<float>(INT16_MAX);
-                    break;
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P:
-                    value = reinterpret_cast<int32_t*>(data)[offset]
-                        / static_cast<float>(INT32_MAX);
-                    break;
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP:
-                    value = reinterpret_cast<float*>(data)[offset];
-                    break;
-                case AV_SAMPLE_FMT_DBL:
-                case AV_SAMPLE_FMT_DBLP:
-                    value = reinterpret_cast<double*>(data)[offset];
-                    break;
-                default:
-                    value = 0.0f;
-                    break;
-                }
-                this->buffer[sample] = value;
+                this->position = av_rescale_q(timestamp, stream->time_base, AVRational{1, this->sample_rate});
+            }
+        }
+        int skip = (int)spek_max64(0, spek_min64(this->seek_frame - this->position, this->frame->nb_samples));
+        this->position += this->frame->nb_samples;
+        if (skip == this->frame->nb_samples) {
+            continue;
+        }
+
+        // We have data, return it and come back for more later.
+        int samples = this->frame->nb_samples - skip;
+        int planes = this->channel == AUDIO_ALL_CHANNELS ? this->channels : 1;
+        int channel = this->channel == AUDIO_ALL_CHANNELS ? 0 : this->channel;
+        AVSampleFormat format = static_cast<AVSampleFormat>(this->frame->format);
+        this->planes.resize(planes);
+        if (format == AV_SAMPLE_FMT_FLTP || (format == AV_SAMPLE_FMT_FLT && this->channels == 1)) {
+            // Already what the pipeline wants, hand out the decoder's own planes.
+            for (int plane = 0; plane < planes; ++plane) {
+                this->planes[plane] =
+                    reinterpret_cast<const float*>(this->frame->extended_data[channel + plane]) + skip;
             }
             return samples;
         }
-        if (this->packet.data) {
-            this->packet.data -= this->offset;
-            this->packet.size += this->offset;
-            this->offset = 0;
-            av_packet_unref(&this->packet);
+
+        if (samples * planes > this->buffer_len) {
+            this->buffer = static_cast<float*>(
+                av_realloc(this->buffer, samples * planes * sizeof(float))
+            );
+            this->buffer_len = samples * planes;
+        }
+        start = spek_now();
+        converter convert = get_converter(format);
+        convert(this->buffer, this->frame->extended_data, skip, samples, this->channels, channel, planes);
+        this->times.convert += spek_now() - start;
+        for (int plane = 0; plane < planes; ++plane) {
+            this->planes[plane] = this->buffer + plane * samples;
+        }
+        return samples;
+    }
+}
+
+PcmAudioFile::PcmAudioFile(
+    const std::string& file_name, std::shared_ptr<const PcmMapping> mapping, const PcmFormat& format
+) :
+    file_name(file_name), mapping(mapping), format(format), convert(get_pcm_converter(format)),
+    error(AudioError::OK), channel(0), interrupted(false), position(0), times(),
+    frames_per_interval(0), error_per_interval(0), error_base(0)
+{
+}
+
+std::unique_ptr<AudioFile> PcmAudioFile::reopen() const
+{
+    return std::unique_ptr<AudioFile>(new PcmAudioFile(this->file_name, this->mapping, this->format));
+}
+
+bool PcmAudioFile::rewind()
+{
+    if (this->interrupted) {
+        return false;
+    }
+    this->position = 0;
+    return true;
+}
+
+std::string PcmAudioFile::get_codec_name() const
+{
+    // What FFmpeg calls them.
+    std::string bits = std::to_string(this->format.bytes * 8);
+    std::string order = this->format.big_endian ? "big-endian" : "little-endian";
+    if (this->format.is_float) {
+        return "PCM " + bits + "-bit floating point " + order;
+    }
+    return "PCM signed " + bits + "-bit " + order;
+}
+
+// The columns come out the same as from AudioFileImpl, with a time base of one frame.
+void PcmAudioFile::start(int channel, int samples)
+{
+    this->channel = channel;
+    if (channel < AUDIO_ALL_CHANNELS || channel >= this->format.channels) {
+        assert(false);
+        this->error = AudioError::NO_CHANNELS;
+    }
+    if (!!this->error) {
+        return;
+    }
+
+    this->error_base = samples;
+    this->frames_per_interval = this->format.frames / samples;
+    this->error_per_interval = this->format.frames % samples;
+}
+
+void PcmAudioFile::start_live(int channel, int frames)
+{
+    start(channel, 1);
+    this->frames_per_interval = frames;
+    this->error_per_interval = 0;
+    this->error_base = 1;
+}
+
+void PcmAudioFile::seek(int64_t frame)
+{
+    this->position = spek_max64(0, spek_min64(frame, this->format.frames));
+    // Reading ahead only starts once the first page is missed.
+    uint64_t frame_size = (uint64_t)this->format.channels * this->format.bytes;
+    this->mapping->will_read(this->format.offset + this->position * frame_size, PCM_PREFETCH);
+}
+
+int PcmAudioFile::read()
+{
+    if (!!this->error || this->interrupted) {
+        return -1;
+    }
+    int samples = (int)spek_min64(PCM_READ_FRAMES, this->format.frames - this->position);
+    if (samples <= 0) {
+        return 0;
+    }
+
+    int planes = this->channel == AUDIO_ALL_CHANNELS ? this->format.channels : 1;
+    int channel = this->channel == AUDIO_ALL_CHANNELS ? 0 : this->channel;
+    this->buffer.resize((size_t)samples * planes);
+    uint64_t frame_size = (uint64_t)this->format.channels * this->format.bytes;
+    uint8_t *data = const_cast<uint8_t*>(this->mapping->get_data()) + this->format.offset +
+        this->position * frame_size;
+    // Page faults are counted in, there is no other time spent reading.
+    int64_t start = spek_now();
+    this->convert(this->buffer.data(), &data, 0, samples, this->format.channels, channel, planes);
+    this->times.convert += spek_now() - start;
+    this->planes.resize(planes);
+    for (int plane = 0; plane < planes; ++plane) {
+        this->planes[plane] = this->buffer.data() + plane * samples;
+    }
+    this->position += samples;
+    return samples;
+}
+
+template<typename T> static inline float sample_scale();
+template<> inline float sample_scale<int16_t>() { return 1.0f / INT16_MAX; }
+template<> inline float sample_scale<int32_t>() { return 1.0f / INT32_MAX; }
+template<> inline float sample_scale<float>() { return 1.0f; }
+template<> inline float sample_scale<double>() { return 1.0f; }
+
+// out[i] = in[i] * scale
+template<typename T> static void convert_plane(float *out, const T *in, int n)
+{
+    const float scale = sample_scale<T>();
+    for (int i = 0; i < n; ++i) {
+        out[i] = in[i] * scale;
+    }
+}
+
+template<> void convert_plane<float>(float *out, const float *in, int n)
+{
+    memcpy(out, in, n * sizeof(float));
+}
+
+template<> void convert_plane<int16_t>(float *out, const int16_t *in, int n)
+{
+    const float scale = sample_scale<int16_t>();
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        // Sign extend by moving each sample into the top half of a 32-bit lane.
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+    }
+#endif
+    for (; i < n; ++i) {
+        out[i] = in[i] * scale;
+    }
+}
+
+template<> void convert_plane<int32_t>(float *out, const int32_t *in, int n)
+{
+    const float scale = sample_scale<int32_t>();
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), vscale));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in + i)), scale));
+    }
+#endif
+    for (; i < n; ++i) {
+        out[i] = in[i] * scale;
+    }
+}
+
+template<typename T> static void convert_planar(
+    float *out, uint8_t *const *data, int skip, int n, int, int channel, int planes)
+{
+    for (int plane = 0; plane < planes; ++plane) {
+        convert_plane(out + plane * n, reinterpret_cast<const T*>(data[channel + plane]) + skip, n);
+    }
+}
+
+// The common case of interleaved stereo, frames [i, n) of both channels or just one of them.
+template<typename T> static void convert_stereo(float *left, float *right, const T *in, int i, int n)
+{
+    const float scale = sample_scale<T>();
+    for (; i < n; ++i) {
+        if (left) {
+            left[i] = in[2 * i] * scale;
+        }
+        if (right) {
+            right[i] = in[2 * i + 1] * scale;
         }
+    }
+}
 
-        int res = 0;
-        while ((res = av_read_frame(this->format_context, &this->packet)) >= 0) {
-            if (this->packet.stream_index == this->audio_stream) {
-                break;
+template<> void convert_stereo<int16_t>(float *left, float *right, const int16_t *in, int i, int n)
+{
+    const float scale = sample_scale<int16_t>();
+#if defined(__SSE2__)
+    // Each 32-bit lane holds a left sample in the bottom half and a right one in the top.
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i));
+        if (left) {
+            __m128i l = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+            _mm_storeu_ps(left + i, _mm_mul_ps(_mm_cvtepi32_ps(l), vscale));
+        }
+        if (right) {
+            __m128i r = _mm_srai_epi32(v, 16);
+            _mm_storeu_ps(right + i, _mm_mul_ps(_mm_cvtepi32_ps(r), vscale));
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int16x8x2_t v = vld2q_s16(in + 2 * i);
+        for (int c = 0; c < 2; ++c) {
+            float *out = c ? right : left;
+            if (out) {
+                vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[c]))), scale));
+                vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[c]))), scale));
             }
-            av_packet_unref(&this->packet);
         }
-        if (res < 0) {
-            // End of file or error.
-            return 0;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (left) {
+            left[i] = in[2 * i] * scale;
+        }
+        if (right) {
+            right[i] = in[2 * i + 1] * scale;
         }
     }
 }
+
+// All channels are de-interleaved in a single pass over the frame.
+template<typename T> static void convert_interleaved(
+    float *out, uint8_t *const *data, int skip, int n, int channels, int channel, int planes)
+{
+    const T *in = reinterpret_cast<const T*>(data[0]) + (int64_t)skip * channels;
+    if (channels == 1) {
+        convert_plane(out, in, n);
+    } else if (channels == 2) {
+        float *left = planes == 2 || channel == 0 ? out : NULL;
+        float *right = planes == 2 ? out + n : channel == 1 ? out : NULL;
+        convert_stereo(left, right, in, 0, n);
+    } else {
+        const float scale = sample_scale<T>();
+        in += channel;
+        for (int i = 0; i < n; ++i, in += channels) {
+            for (int plane = 0; plane < planes; ++plane) {
+                out[plane * n + i] = in[plane] * scale;
+            }
+        }
+    }
+}
+
+// Packed integers of `bytes` bytes in either byte order, as they are stored in WAV and AIFF.
+template<int bytes, bool big_endian> static void convert_packed(
+    float *out, uint8_t *const *data, int skip, int n, int channels, int channel, int planes)
+{
+    // Each sample goes into the top of an int32_t, it comes out like the S32 that FFmpeg decodes.
+    const float scale = bytes == 2 ? sample_scale<int16_t>() / 65536 : sample_scale<int32_t>();
+    const uint8_t *in = data[0] + ((int64_t)skip * channels + channel) * bytes;
+    for (int i = 0; i < n; ++i, in += channels * bytes) {
+        for (int plane = 0; plane < planes; ++plane) {
+            const uint8_t *sample = in + plane * bytes;
+            uint32_t value = 0;
+            for (int b = 0; b < bytes; ++b) {
+                value |= (uint32_t)sample[big_endian ? b : bytes - 1 - b] << (24 - 8 * b);
+            }
+            out[plane * n + i] = (int32_t)value * scale;
+        }
+    }
+}
+
+static void convert_silence(float *out, uint8_t *const *, int, int n, int, int, int planes)
+{
+    memset(out, 0, (size_t)n * planes * sizeof(float));
+}
+
+static converter get_converter(AVSampleFormat format)
+{
+    switch (format) {
+    case AV_SAMPLE_FMT_S16:
+        return convert_interleaved<int16_t>;
+    case AV_SAMPLE_FMT_S16P:
+        return convert_planar<int16_t>;
+    case AV_SAMPLE_FMT_S32:
+        return convert_interleaved<int32_t>;
+    case AV_SAMPLE_FMT_S32P:
+        return convert_planar<int32_t>;
+    case AV_SAMPLE_FMT_FLT:
+        return convert_interleaved<float>;
+    case AV_SAMPLE_FMT_FLTP:
+        return convert_planar<float>;
+    case AV_SAMPLE_FMT_DBL:
+        return convert_interleaved<double>;
+    case AV_SAMPLE_FMT_DBLP:
+        return convert_planar<double>;
+    default:
+        return convert_silence;
+    }
+}
+
+static converter get_pcm_converter(const PcmFormat& format)
+{
+    // Samples the size of a type can be read as such where they are aligned to it.
+    bool aligned = format.offset % format.bytes == 0;
+    if (format.is_float) {
+        if (!aligned || format.big_endian) {
+            return nullptr;
+        }
+        return format.bytes == 4 ? convert_interleaved<float> : convert_interleaved<double>;
+    }
+    switch (format.bytes) {
+    case 2:
+        return format.big_endian ? convert_packed<2, true> :
+            aligned ? convert_interleaved<int16_t> : convert_packed<2, false>;
+    case 3:
+        return format.big_endian ? convert_packed<3, true> : convert_packed<3, false>;
+    case 4:
+        return format.big_endian ? convert_packed<4, true> :
+            aligned ? convert_interleaved<int32_t> : convert_packed<4, false>;
+    default:
+        return nullptr;
+    }
+}
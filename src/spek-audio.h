@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 #include <memory>
 #include <ostream>
 #include <string>
@@ -7,13 +9,30 @@
 class AudioFile;
 enum class AudioError;
 
+enum
+{
+    AUDIO_ALL_CHANNELS = -1,
+};
+
 class Audio
 {
 public:
-    Audio();
+    // With `dump_format` set, the format of every file opened is printed to stderr.
+    Audio(bool dump_format = false);
     ~Audio();
 
     std::unique_ptr<AudioFile> open(const std::string& file_name, const std::string& device_name, int stream);
+
+private:
+    bool dump_format;
+};
+
+// Nanoseconds spent in AudioFile::read() so far, see spek_now().
+struct AudioTimes
+{
+    int64_t demux; // Reading packets of the stream.
+    int64_t decode;
+    int64_t convert; // Decoded samples to float planes.
 };
 
 class AudioFile
@@ -21,7 +40,25 @@ class AudioFile
 public:
     virtual ~AudioFile() {}
 
+    // Another instance reading the same stream independently, or nullptr if that's not possible.
+    // What was found out about the stream is reused, the file is not probed again.
+    virtual std::unique_ptr<AudioFile> reopen() const = 0;
+    // Back to the start of the stream, so that it can be start()ed again with other parameters.
+    // Returns false if it can't, e.g. for live input or after interrupt(), reopen() it then.
+    virtual bool rewind() = 0;
+    // Make a read() in progress on another thread return soon, safe to call from any thread.
+    // Nothing can be read after that.
+    virtual void interrupt() = 0;
+
+    // Pass AUDIO_ALL_CHANNELS to decode every channel in one pass.
     virtual void start(int channel, int samples) = 0;
+    // Live input has no duration, every `frames` frames per channel make a column instead.
+    virtual void start_live(int channel, int frames) = 0;
+    // Continue reading at `frame`, counted in samples per channel from the start of the stream.
+    // Streams that can't seek are decoded up to it.
+    virtual void seek(int64_t frame) = 0;
+    // Returns the number of samples per channel. When decoding all channels there is one
+    // plane of that many samples per channel, see get_plane().
     virtual int read() = 0;
 
     virtual AudioError get_error() const = 0;
@@ -31,11 +68,15 @@ public:
     virtual int get_bits_per_sample() const = 0;
     virtual int get_streams() const = 0;
     virtual int get_channels() const = 0;
+    // Zero for live input.
     virtual double get_duration() const = 0;
-    virtual const float *get_buffer() const = 0;
+    // Samples from the last read(), valid until the next one.
+    virtual const float *get_plane(int plane) const = 0;
     virtual int64_t get_frames_per_interval() const = 0;
     virtual int64_t get_error_per_interval() const = 0;
     virtual int64_t get_error_base() const = 0;
+    // Only safe to call from the thread that reads.
+    virtual AudioTimes get_times() const = 0;
 };
 
 enum class AudioError
@@ -0,0 +1,548 @@
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <wx/app.h>
+#include <wx/cmdline.h>
+#include <wx/crt.h>
+#include <wx/filename.h>
+#include <wx/init.h>
+#include <wx/thread.h>
+
+#include "spek-audio.h"
+#include "spek-fft.h"
+#include "spek-palette.h"
+#include "spek-pipeline.h"
+#include "spek-png.h"
+#include "spek-scale.h"
+#include "spek-sink.h"
+#include "spek-utils.h"
+
+#include "spek-batch.h"
+
+enum
+{
+    WIDTH = 1000,
+    FFT_BITS = 11,
+    MIN_FFT_BITS = 8,
+    MAX_FFT_BITS = 14,
+    URANGE = 0,
+    LRANGE = -120,
+    STRIP_ROWS = 64,
+};
+
+enum export_format
+{
+    EXPORT_PNG,
+    EXPORT_NPY,
+    EXPORT_NPY16,
+    EXPORT_RAW,
+};
+
+struct BatchOptions
+{
+    wxString output;
+    int width;
+    int height; // 0 for one pixel per band.
+    int fft_bits;
+    int overlap;
+    enum frequency_scale scale;
+    enum spectrum_type spectrum;
+    enum palette palette;
+    enum export_format format;
+    FFT *fft; // Shared by all files.
+    int threads; // Per file.
+    bool stats; // Print where the time went for each file.
+};
+
+// Coloured columns of one image kept in a temporary file, they only come together row by row
+// when the image is saved.
+class ImageSink : public ColumnSink
+{
+public:
+    ImageSink(int columns, int bands, int height, enum palette palette) :
+        columns(columns), bands(bands), height(height), file(tmpfile(), height * 3), lut(PALETTE_LUT_SIZE)
+    {
+        spek_palette_lut(this->lut.data(), palette);
+        // Columns that never arrive read back as black holes of the file.
+        std::vector<unsigned char> black(height * 3);
+        this->file.write(columns - 1, black.data());
+    }
+
+    void write(int, int column, const float *values) override
+    {
+        // Top row first, box average when there are more bands than rows, linear in between otherwise.
+        std::vector<float> levels(this->height);
+        for (int y = 0; y < this->height; ++y) {
+            int row = this->height - y - 1;
+            if (this->height <= this->bands) {
+                int from = (int64_t)row * this->bands / this->height;
+                int to = (int64_t)(row + 1) * this->bands / this->height;
+                float sum = 0.0f;
+                for (int i = from; i < to; ++i) {
+                    sum += values[i];
+                }
+                levels[y] = sum / (to - from);
+            } else {
+                double position = (double)row * (this->bands - 1) / (this->height - 1);
+                int i = spek_min((int)position, this->bands - 2);
+                float t = position - i;
+                levels[y] = values[i] + (values[i + 1] - values[i]) * t;
+            }
+        }
+        std::vector<uint32_t> colors(this->height);
+        spek_palette_map(colors.data(), levels.data(), this->height, this->lut.data(), LRANGE, URANGE);
+        std::vector<unsigned char> pixels(this->height * 3);
+        for (int y = 0; y < this->height; ++y) {
+            pixels[y * 3] = colors[y] >> 16;
+            pixels[y * 3 + 1] = (colors[y] >> 8) & 0xFF;
+            pixels[y * 3 + 2] = colors[y] & 0xFF;
+        }
+        this->file.write(column, pixels.data());
+    }
+
+    bool finish() override
+    {
+        return this->file.is_ok();
+    }
+
+    // Turn the columns into rows a strip at a time.
+    bool save(const wxString& out)
+    {
+        PngWriter png(out, this->columns, this->height);
+        std::vector<unsigned char> strip((size_t)STRIP_ROWS * this->columns * 3);
+        std::vector<unsigned char> pixels(STRIP_ROWS * 3);
+        for (int y0 = 0; y0 < this->height; y0 += STRIP_ROWS) {
+            int rows = spek_min((int)STRIP_ROWS, this->height - y0);
+            for (int x = 0; x < this->columns; ++x) {
+                if (!this->file.read(x, y0 * 3, rows * 3, pixels.data())) {
+                    return false;
+                }
+                for (int y = 0; y < rows; ++y) {
+                    memcpy(&strip[((size_t)y * this->columns + x) * 3], &pixels[y * 3], 3);
+                }
+            }
+            for (int y = 0; y < rows; ++y) {
+                if (!png.write_row(&strip[(size_t)y * this->columns * 3])) {
+                    return false;
+                }
+            }
+        }
+        return png.finish();
+    }
+
+private:
+    int columns;
+    int bands;
+    int height;
+    ColumnFile file;
+    std::vector<uint32_t> lut;
+};
+
+// The pipeline of one file hands its columns to the sink from its worker threads.
+struct BatchRun
+{
+    ColumnSink *sink;
+    int bands;
+    int columns;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done;
+};
+
+static void pipeline_cb(int bands, int channel, int sample, float *values, void *cb_data)
+{
+    BatchRun *run = (BatchRun *)cb_data;
+    if (sample == -1) {
+        std::lock_guard<std::mutex> lock(run->mutex);
+        run->done = true;
+        run->cond.notify_one();
+        return;
+    }
+    if (bands == run->bands && sample >= 0 && sample < run->columns) {
+        run->sink->write(channel, sample, values);
+    }
+}
+
+static bool parse_export(const wxString& name, enum export_format *format)
+{
+    static const char *names[] = {"png", "npy", "npy16", "raw"};
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i) {
+        if (name == names[i]) {
+            *format = (enum export_format)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_overlap(const wxString& value, int *overlap)
+{
+    long percent;
+    if (value == "auto") {
+        *overlap = OVERLAP_AUTO;
+    } else if (value.ToLong(&percent) && percent >= 0 && percent <= MAX_OVERLAP) {
+        *overlap = percent;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_scale(const wxString& name, enum frequency_scale *scale)
+{
+    static const char *names[SCALE_COUNT] = {"linear", "log", "mel"};
+    for (int i = 0; i < SCALE_COUNT; ++i) {
+        if (name == names[i]) {
+            *scale = (enum frequency_scale)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_spectrum(const wxString& name, enum spectrum_type *spectrum)
+{
+    static const char *names[SPECTRUM_COUNT] = {"mean", "max", "min"};
+    for (int i = 0; i < SPECTRUM_COUNT; ++i) {
+        if (name == names[i]) {
+            *spectrum = (enum spectrum_type)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_palette(const wxString& name, enum palette *palette)
+{
+    static const char *names[PALETTE_COUNT] = {"spectrum", "sox", "mono"};
+    for (int i = 0; i < PALETTE_COUNT; ++i) {
+        if (name == names[i]) {
+            *palette = (enum palette)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Analyse `path` and save it as `out`, logging errors to stderr. Images only show the first
+// channel, the other formats keep all of them.
+static bool render_file(Audio& audio, const wxString& path, const wxString& out, const BatchOptions& options)
+{
+    auto file = audio.open(std::string(path.utf8_str()), "", 0);
+    if (!!file->get_error()) {
+        wxFprintf(stderr, "%s: %s\n", path, wxString::FromUTF8(spek_file_desc(*file, 0, 0).c_str()));
+        return false;
+    }
+
+    // Other scales fold the bands into as many rows as the image has.
+    BatchRun run;
+    int bands = (1 << (options.fft_bits - 1)) + 1;
+    run.bands = options.scale != SCALE_LINEAR && options.height ? options.height : bands;
+    run.columns = options.width;
+    run.done = false;
+    int channel = options.format == EXPORT_PNG ? 0 : AUDIO_ALL_CHANNELS;
+    int channels = options.format == EXPORT_PNG ? 1 : file->get_channels();
+    ImageSink *image = NULL;
+    std::unique_ptr<ColumnSink> sink;
+    switch (options.format) {
+    case EXPORT_PNG:
+        image = new ImageSink(
+            run.columns, run.bands, options.height ? options.height : run.bands, options.palette
+        );
+        sink.reset(image);
+        break;
+    case EXPORT_NPY:
+    case EXPORT_NPY16:
+        sink.reset(new NpySink(
+            wxFopen(out, "wb"), channels, run.bands, 0, run.columns,
+            options.format == EXPORT_NPY16 ? SINK_FLOAT16 : SINK_FLOAT32
+        ));
+        break;
+    case EXPORT_RAW:
+        sink.reset(new RawSink(wxFopen(out, "wb"), channels, run.bands, 0, run.columns));
+        break;
+    }
+    run.sink = sink.get();
+    spek_pipeline *pipeline = spek_pipeline_open(
+        std::move(file), options.fft, options.fft_bits, options.threads, 0, channel, WINDOW_DEFAULT,
+        options.overlap, run.columns, 0, run.columns, pipeline_cb, &run
+    );
+    if (options.scale != SCALE_LINEAR) {
+        spek_pipeline_set_band_map(
+            pipeline, BandMap::get(options.scale, bands, spek_pipeline_sample_rate(pipeline), run.bands)
+        );
+    }
+    spek_pipeline_set_spectra(pipeline, 1 << options.spectrum);
+    spek_pipeline_start(pipeline);
+    {
+        std::unique_lock<std::mutex> lock(run.mutex);
+        run.cond.wait(lock, [&run] { return run.done; });
+    }
+    if (options.stats) {
+        std::string stats = spek_pipeline_format_stats(spek_pipeline_get_stats(pipeline));
+        wxFprintf(stderr, "%s: %s\n", path, wxString::FromUTF8(stats.c_str()));
+    }
+    spek_pipeline_close(pipeline);
+
+    if (!sink->finish() || (image && !image->save(out))) {
+        wxFprintf(stderr, "%s: cannot write %s\n", path, out);
+        return false;
+    }
+    return true;
+}
+
+int spek_batch(int argc, char **argv)
+{
+    // Nothing of the GUI is initialised, this works without a display.
+    wxApp::SetInitializerFunction(NULL);
+    wxInitializer initializer(argc, argv);
+    if (!initializer.IsOk()) {
+        return 1;
+    }
+
+    static const wxCmdLineEntryDesc desc[] = {{
+            wxCMD_LINE_SWITCH,
+            "h",
+            "help",
+            "Show this help message",
+            wxCMD_LINE_VAL_NONE,
+            wxCMD_LINE_OPTION_HELP,
+        }, {
+            wxCMD_LINE_SWITCH,
+            NULL,
+            "batch",
+            "Save spectrograms of all files and exit",
+            wxCMD_LINE_VAL_NONE,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            "o",
+            "output",
+            "Directory for the images, the current one by default",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "width",
+            "Width of the images in pixels",
+            wxCMD_LINE_VAL_NUMBER,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "height",
+            "Height of the images in pixels, one per frequency band by default",
+            wxCMD_LINE_VAL_NUMBER,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "fft-bits",
+            "DFT window size as a power of two, from 8 to 14",
+            wxCMD_LINE_VAL_NUMBER,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "overlap",
+            "Overlap of the DFT windows in percent, from 0 to 75, or auto",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "fft-backend",
+            "DFT library, the fastest one by default",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "scale",
+            "Frequency scale: linear, log or mel",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "spectrum",
+            "What each column shows of its DFTs: mean, max or min",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "palette",
+            "Colour palette: spectrum, sox or mono",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "export",
+            "Output format: png, npy, npy16 (half precision) or raw (float32)",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            "j",
+            "jobs",
+            "Files analysed at the same time",
+            wxCMD_LINE_VAL_NUMBER,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_SWITCH,
+            "v",
+            "verbose",
+            "Print the format of each file",
+            wxCMD_LINE_VAL_NONE,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_SWITCH,
+            NULL,
+            "stats",
+            "Print how long each stage of the analysis took",
+            wxCMD_LINE_VAL_NONE,
+            wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_PARAM,
+            NULL,
+            NULL,
+            "FILE",
+            wxCMD_LINE_VAL_STRING,
+            wxCMD_LINE_PARAM_MULTIPLE,
+        },
+        wxCMD_LINE_DESC_END,
+    };
+
+    wxCmdLineParser parser(desc, argc, argv);
+    int ret = parser.Parse(true);
+    if (ret == -1) {
+        return 0;
+    }
+    if (ret) {
+        return 2;
+    }
+
+    BatchOptions options;
+    options.output = ".";
+    parser.Found("output", &options.output);
+    long width = WIDTH, height = 0, fft_bits = FFT_BITS, jobs = 1;
+    parser.Found("width", &width);
+    parser.Found("height", &height);
+    parser.Found("fft-bits", &fft_bits);
+    parser.Found("jobs", &jobs);
+    options.palette = PALETTE_DEFAULT;
+    wxString palette;
+    if (parser.Found("palette", &palette) && !parse_palette(palette, &options.palette)) {
+        wxFprintf(stderr, "Unknown palette: %s\n", palette);
+        return 2;
+    }
+    options.format = EXPORT_PNG;
+    wxString format;
+    if (parser.Found("export", &format) && !parse_export(format, &options.format)) {
+        wxFprintf(stderr, "Unknown format: %s\n", format);
+        return 2;
+    }
+    std::vector<std::string> backends = FFT::get_backends();
+    wxString backend;
+    if (parser.Found("fft-backend", &backend) &&
+        std::find(backends.begin(), backends.end(), std::string(backend.utf8_str())) == backends.end()) {
+        wxFprintf(stderr, "Unknown FFT backend: %s\n", backend);
+        return 2;
+    }
+    FFT fft(std::string(backend.utf8_str()));
+    options.fft = &fft;
+    options.scale = SCALE_DEFAULT;
+    wxString scale;
+    if (parser.Found("scale", &scale) && !parse_scale(scale, &options.scale)) {
+        wxFprintf(stderr, "Unknown scale: %s\n", scale);
+        return 2;
+    }
+    options.spectrum = SPECTRUM_MEAN;
+    wxString spectrum;
+    if (parser.Found("spectrum", &spectrum) && !parse_spectrum(spectrum, &options.spectrum)) {
+        wxFprintf(stderr, "Unknown spectrum: %s\n", spectrum);
+        return 2;
+    }
+    options.overlap = OVERLAP_AUTO;
+    wxString overlap;
+    if (parser.Found("overlap", &overlap) && !parse_overlap(overlap, &options.overlap)) {
+        wxFprintf(stderr, "Bad overlap: %s\n", overlap);
+        return 2;
+    }
+    if (!parser.GetParamCount() || width <= 0 || height < 0 ||
+        fft_bits < MIN_FFT_BITS || fft_bits > MAX_FFT_BITS || jobs <= 0) {
+        parser.Usage();
+        return 2;
+    }
+    options.width = width;
+    options.height = height;
+    options.fft_bits = fft_bits;
+    jobs = spek_min(jobs, (int)parser.GetParamCount());
+    // The cores are shared between the files in flight.
+    options.threads = spek_max(1, wxThread::GetCPUCount() / spek_max(1, jobs));
+    options.stats = parser.Found("stats");
+
+    // Files of the same name keep their extension, x.flac.png and x.wav.png. Nothing is saved if
+    // two of them would still overwrite each other, e.g. from different directories.
+    static const char *extensions[] = {"png", "npy", "npy", "f32"};
+    std::map<std::string, int> names;
+    for (size_t i = 0; i < parser.GetParamCount(); ++i) {
+        names[std::string(wxFileName(parser.GetParam(i)).GetName().utf8_str())]++;
+    }
+    std::vector<wxString> outputs;
+    std::map<std::string, wxString> inputs; // Of each output.
+    for (size_t i = 0; i < parser.GetParamCount(); ++i) {
+        wxString path = parser.GetParam(i);
+        wxFileName file(path);
+        bool clash = names[std::string(file.GetName().utf8_str())] > 1;
+        wxString name = clash ? file.GetFullName() : file.GetName();
+        outputs.push_back(wxFileName(options.output, name, extensions[options.format]).GetFullPath());
+        std::string key(outputs.back().utf8_str());
+        if (inputs.count(key)) {
+            wxFprintf(stderr, "%s and %s would both be saved as %s\n", inputs[key], path, outputs.back());
+            return 1;
+        }
+        inputs[key] = path;
+    }
+
+    if (!wxFileName::DirExists(options.output) &&
+        !wxFileName::Mkdir(options.output, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL)) {
+        wxFprintf(stderr, "Cannot create %s\n", options.output);
+        return 1;
+    }
+
+    // Each job takes the next file until there are none left.
+    Audio audio(parser.Found("verbose"));
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    auto job = [&] {
+        size_t i;
+        while ((i = next++) < parser.GetParamCount()) {
+            if (!render_file(audio, parser.GetParam(i), outputs[i], options)) {
+                failed = true;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < jobs; ++i) {
+        threads.emplace_back(job);
+    }
+    job();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Render spectrograms of the files on the command line into PNG images, without a window or an
+// event loop. Returns the exit status of the program.
+int spek_batch(int argc, char **argv);
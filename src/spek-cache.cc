@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include <algorithm>
+
+#include "spek-cache.h"
+
+#define CACHE_MAGIC "SPEKCACH"
+#define CACHE_EXTENSION ".cache"
+
+enum
+{
+    CACHE_VERSION = 1,
+    MIN_DB = -160, // Below the lowest range the palette goes down to.
+    MAX_DB = 16,
+};
+
+// Native byte order, the files never leave the machine.
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bits;
+    int32_t channels;
+    int32_t bands;
+    int32_t columns;
+    int32_t streams;
+    int32_t sample_rate;
+    uint32_t strings_size; // The key and the descriptions follow, each ends with a zero.
+    double duration;
+    float offset;
+    float step;
+    uint64_t data_offset;
+};
+
+struct CacheFile
+{
+    std::string path;
+    int64_t size;
+    int64_t time;
+};
+
+// FNV-1a, the key itself is stored in the file to tell collisions apart.
+static uint64_t hash(const std::string& s)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : s) {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    return h;
+}
+
+static std::vector<CacheFile> list_files(const std::string& dir)
+{
+    std::vector<CacheFile> files;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "/*" CACHE_EXTENSION).c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return files;
+    }
+    do {
+        int64_t size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        int64_t time = ((int64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+        files.push_back(CacheFile{dir + "/" + data.cFileName, size, time});
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return files;
+    }
+    const size_t extension = strlen(CACHE_EXTENSION);
+    while (struct dirent *entry = readdir(d)) {
+        size_t length = strlen(entry->d_name);
+        if (length <= extension || strcmp(entry->d_name + length - extension, CACHE_EXTENSION)) {
+            continue;
+        }
+        std::string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if (!stat(path.c_str(), &st)) {
+            files.push_back(CacheFile{path, (int64_t)st.st_size, (int64_t)st.st_mtime});
+        }
+    }
+    closedir(d);
+#endif
+    return files;
+}
+
+// 0 marks columns that were never analysed, -inf and NaN end up just above it.
+static unsigned quantise(float value, float offset, float step, unsigned max)
+{
+    float q = (value - offset) / step + 1.0f;
+    if (!(q >= 1.0f)) {
+        return 1;
+    }
+    if (q >= max - 0.5f) {
+        return max;
+    }
+    return (unsigned)(q + 0.5f);
+}
+
+CacheEntry::~CacheEntry()
+{
+#ifdef _WIN32
+    if (this->map) {
+        UnmapViewOfFile(this->map);
+    }
+    if (this->mapping) {
+        CloseHandle(this->mapping);
+    }
+#else
+    if (this->map) {
+        munmap(this->map, this->map_size);
+    }
+#endif
+}
+
+bool CacheEntry::read(int channel, int column, float *values) const
+{
+    int bands = this->info.bands;
+    size_t index = ((size_t)column * this->info.channels + channel) * bands;
+    if (this->bits == 8) {
+        const uint8_t *q = this->data + index;
+        if (!q[0]) {
+            return false;
+        }
+        for (int i = 0; i < bands; ++i) {
+            values[i] = this->offset + (q[i] - 1) * this->step;
+        }
+    } else {
+        const uint16_t *q = (const uint16_t *)this->data + index;
+        if (!q[0]) {
+            return false;
+        }
+        for (int i = 0; i < bands; ++i) {
+            values[i] = this->offset + (q[i] - 1) * this->step;
+        }
+    }
+    return true;
+}
+
+SpectrumCache::SpectrumCache(const std::string& dir, int64_t max_size) : dir(dir), max_size(max_size)
+{
+}
+
+std::unique_ptr<CacheEntry> SpectrumCache::find(const std::string& key)
+{
+    std::string path = this->path(key, CACHE_EXTENSION);
+    std::unique_ptr<CacheEntry> entry(new CacheEntry());
+    entry->map = NULL;
+    entry->map_size = 0;
+#ifdef _WIN32
+    entry->mapping = NULL;
+    HANDLE file = CreateFileA(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size)) {
+        entry->map_size = size.QuadPart;
+        entry->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(file);
+    if (entry->mapping) {
+        entry->map = MapViewOfFile(entry->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (!fstat(fd, &st) && st.st_size > 0) {
+        entry->map_size = st.st_size;
+        entry->map = mmap(NULL, entry->map_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (entry->map == MAP_FAILED) {
+            entry->map = NULL;
+        }
+    }
+    close(fd);
+#endif
+    if (!entry->map || entry->map_size < sizeof(CacheHeader)) {
+        return nullptr;
+    }
+
+    const unsigned char *bytes = (const unsigned char *)entry->map;
+    CacheHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) || header.version != CACHE_VERSION ||
+        (header.bits != 8 && header.bits != 16) || header.channels <= 0 || header.bands <= 0 ||
+        header.columns <= 0 || sizeof(header) + (uint64_t)header.strings_size > header.data_offset ||
+        header.data_offset % 16) {
+        return nullptr;
+    }
+    uint64_t data_size = (uint64_t)header.columns * header.channels * header.bands * (header.bits / 8);
+    if (header.data_offset + data_size > entry->map_size) {
+        return nullptr;
+    }
+
+    // The key first, then one description per channel.
+    const char *strings = (const char *)bytes + sizeof(header);
+    const char *end = strings + header.strings_size;
+    std::vector<std::string> items;
+    while (strings < end) {
+        const char *zero = (const char *)memchr(strings, 0, end - strings);
+        if (!zero) {
+            return nullptr;
+        }
+        items.push_back(std::string(strings, zero));
+        strings = zero + 1;
+    }
+    if ((int)items.size() != 1 + header.channels || items[0] != key) {
+        return nullptr;
+    }
+
+    entry->info.channels = header.channels;
+    entry->info.bands = header.bands;
+    entry->info.columns = header.columns;
+    entry->info.streams = header.streams;
+    entry->info.sample_rate = header.sample_rate;
+    entry->info.duration = header.duration;
+    entry->info.descs.assign(items.begin() + 1, items.end());
+    entry->data = bytes + header.data_offset;
+    entry->bits = header.bits;
+    entry->offset = header.offset;
+    entry->step = header.step;
+
+    // The modification time keeps track of when it was last used.
+    utime(path.c_str(), NULL);
+    return entry;
+}
+
+bool SpectrumCache::save(
+    const std::string& key, const CacheInfo& info, int bits,
+    std::function<const float *(int channel, int column)> get
+)
+{
+#ifdef _WIN32
+    _mkdir(this->dir.c_str());
+#else
+    mkdir(this->dir.c_str(), 0755);
+#endif
+    std::string path = this->path(key, CACHE_EXTENSION);
+    std::string tmp_path = this->path(key, ".tmp");
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    std::string strings = key + '\0';
+    for (const auto& desc : info.descs) {
+        strings += desc + '\0';
+    }
+    unsigned max = (1u << bits) - 1;
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.bits = bits;
+    header.channels = info.channels;
+    header.bands = info.bands;
+    header.columns = info.columns;
+    header.streams = info.streams;
+    header.sample_rate = info.sample_rate;
+    header.strings_size = strings.size();
+    header.duration = info.duration;
+    header.offset = MIN_DB;
+    header.step = (float)(MAX_DB - MIN_DB) / (max - 1);
+    header.data_offset = (sizeof(header) + strings.size() + 15) / 16 * 16;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(strings.data(), strings.size(), 1, file) == 1;
+    std::vector<unsigned char> padding(header.data_offset - sizeof(header) - strings.size());
+    ok = ok && (padding.empty() || fwrite(padding.data(), padding.size(), 1, file) == 1);
+
+    size_t count = (size_t)info.channels * info.bands;
+    std::vector<uint8_t> column8(bits == 8 ? count : 0);
+    std::vector<uint16_t> column16(bits == 8 ? 0 : count);
+    for (int column = 0; ok && column < info.columns; ++column) {
+        for (int channel = 0; channel < info.channels; ++channel) {
+            const float *values = get(channel, column);
+            size_t index = (size_t)channel * info.bands;
+            for (int i = 0; i < info.bands; ++i) {
+                unsigned q = values ? quantise(values[i], header.offset, header.step, max) : 0;
+                if (bits == 8) {
+                    column8[index + i] = q;
+                } else {
+                    column16[index + i] = q;
+                }
+            }
+        }
+        ok = bits == 8 ?
+            fwrite(column8.data(), count, 1, file) == 1 :
+            fwrite(column16.data(), count * sizeof(uint16_t), 1, file) == 1;
+    }
+    ok = !fclose(file) && ok;
+
+    // Readers only ever see complete files.
+    remove(path.c_str());
+    if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    this->evict(path);
+    return true;
+}
+
+void SpectrumCache::clear()
+{
+    for (const auto& file : list_files(this->dir)) {
+        remove(file.path.c_str());
+    }
+}
+
+std::string SpectrumCache::path(const std::string& key, const char *extension) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash(key));
+    return this->dir + "/" + name + extension;
+}
+
+// Least recently used first, the file that was just saved stays.
+void SpectrumCache::evict(const std::string& keep)
+{
+    std::vector<CacheFile> files = list_files(this->dir);
+    int64_t total = 0;
+    for (const auto& file : files) {
+        total += file.size;
+    }
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) {
+        return a.time < b.time;
+    });
+    for (const auto& file : files) {
+        if (total <= this->max_size) {
+            break;
+        }
+        if (file.path != keep && !remove(file.path.c_str())) {
+            total -= file.size;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// What a spectrogram needs besides its columns, so that a cached one can be shown without
+// opening the file.
+struct CacheInfo
+{
+    int channels;
+    int bands;
+    int columns;
+    int streams;
+    int sample_rate;
+    double duration;
+    std::vector<std::string> descs; // One per channel.
+};
+
+// A cached spectrogram, mapped into memory until it's destroyed.
+class CacheEntry
+{
+public:
+    ~CacheEntry();
+
+    const CacheInfo& get_info() const { return this->info; }
+    // Dequantise a column into `bands` dB values, returns false if it was never analysed.
+    bool read(int channel, int column, float *values) const;
+
+private:
+    friend class SpectrumCache;
+    CacheEntry() {}
+
+    CacheInfo info;
+    const unsigned char *data; // All channels of column 0, then column 1 and so on.
+    int bits;
+    float offset;
+    float step;
+    void *map;
+    size_t map_size;
+#ifdef _WIN32
+    void *mapping;
+#endif
+};
+
+// Finished spectrograms kept on disk between runs, one file each in `dir`. They are looked up
+// by a key that has to change whenever the file or the analysis does, e.g. the path, size and
+// modification time of the file and every setting that goes into the columns.
+//
+// Values are quantised to 8 or 16 bits. Once the files take more than `max_size` bytes the
+// least recently used ones are removed.
+class SpectrumCache
+{
+public:
+    SpectrumCache(const std::string& dir, int64_t max_size);
+
+    // Returns nullptr if there is no usable entry for `key`.
+    std::unique_ptr<CacheEntry> find(const std::string& key);
+    // `get` returns the `bands` values of a column or NULL if it's missing.
+    bool save(
+        const std::string& key, const CacheInfo& info, int bits,
+        std::function<const float *(int channel, int column)> get
+    );
+    // Remove every cached spectrogram.
+    void clear();
+
+private:
+    std::string path(const std::string& key, const char *extension) const;
+    void evict(const std::string& keep);
+
+    std::string dir;
+    int64_t max_size;
+};
@@ -2,24 +2,22 @@
 
 #include <wx/wx.h>
 
+// Posted when new columns are ready in the TileStore, at most one is pending at a time.
 class SpekHaveSampleEvent: public wxEvent
 {
 public:
-    SpekHaveSampleEvent(int bands, int sample, float *values, bool free_values);
-    SpekHaveSampleEvent(const SpekHaveSampleEvent& other);
-    ~SpekHaveSampleEvent();
+    SpekHaveSampleEvent(bool done, int generation);
 
-    int get_bands() const { return this->bands; }
-    int get_sample() const { return this->sample; }
-    const float *get_values() const { return this->values; }
+    // The pipeline has finished, this is the last event.
+    bool is_done() const { return this->done; }
+    // Of the pass that posted it, events of passes that were stopped since are dropped.
+    int get_generation() const { return this->generation; }
 
     wxEvent *Clone() const { return new SpekHaveSampleEvent(*this); }
 
 private:
-    int bands;
-    int sample;
-    float *values;
-    bool free_values;
+    bool done;
+    int generation;
 };
 
 typedef void (wxEvtHandler::*SpekHaveSampleEventFunction)(SpekHaveSampleEvent&);
@@ -1,50 +1,950 @@
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #define __STDC_CONSTANT_MACROS
 extern "C" {
+#if HAVE_LIBAVCODEC_AVFFT_H
 #include <libavcodec/avfft.h>
+#endif
+#if HAVE_DECL_AV_TX_FLOAT_RDFT
+#include <libavutil/tx.h>
+#endif
 }
+#if HAVE_FFTW
+#include <fftw3.h>
+#endif
+#if HAVE_OPENCL
+#define CL_TARGET_OPENCL_VERSION 120
+#if defined(OS_OSX)
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+#endif
 
 #include "spek-fft.h"
 
-class FFTPlanImpl : public FFTPlan
+enum
+{
+    ALIGNMENT = 64, // Bytes, enough for any SIMD the libraries use.
+};
+
+class FFTBackend
+{
+public:
+    virtual ~FFTBackend() {}
+    virtual std::unique_ptr<FFTPlan> create(int nbits, int batch) = 0;
+    virtual int get_batch_frames() const { return 0; }
+};
+
+// Forward declarations.
+static void power(float *out, const float *in, int n, float scale);
+static FFTBackend *create_fallback();
+
+// `size` zeros aligned to ALIGNMENT bytes, kept in `data`.
+static float *aligned(std::vector<float>& data, size_t size)
+{
+    data.assign(size + ALIGNMENT / sizeof(float), 0.0f);
+    return (float *)(((uintptr_t)data.data() + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1));
+}
+
+// Floats between the complex spectra of a batch, keeping each of them aligned.
+static size_t spectrum_stride(int n)
+{
+    const size_t floats = ALIGNMENT / sizeof(float);
+    return (n + 2 + floats - 1) / floats * floats;
+}
+
+// Contexts that can't be shared between threads. The ones of destroyed plans are kept for the
+// next plan of the same size.
+template<class T> class ContextPool
+{
+public:
+    ContextPool(T *(*init)(int nbits), void (*end)(T *cx)) : init(init), end(end) {}
+
+    ~ContextPool()
+    {
+        for (auto& contexts : this->free) {
+            for (T *cx : contexts.second) {
+                this->end(cx);
+            }
+        }
+    }
+
+    T *take(int nbits)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto& contexts = this->free[nbits];
+            if (!contexts.empty()) {
+                T *cx = contexts.back();
+                contexts.pop_back();
+                return cx;
+            }
+        }
+        return this->init(nbits);
+    }
+
+    void give(int nbits, T *cx)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->free[nbits].push_back(cx);
+    }
+
+private:
+    T *(*init)(int nbits);
+    void (*end)(T *cx);
+    std::mutex mutex;
+    std::map<int, std::vector<T *>> free;
+};
+
+#if HAVE_FFTW
+// The planner of FFTW is shared by the whole process and isn't thread-safe.
+static std::mutex fftw_mutex;
+
+class FftwPlan : public FFTPlan
+{
+public:
+    FftwPlan(fftwf_plan plan, int nbits, int batch) :
+        FFTPlan(nbits, batch), plan(plan),
+        spectrum(aligned(this->spectrum_data, batch * spectrum_stride(1 << nbits))) {}
+
+    void execute_many(int count) override
+    {
+        int n = this->get_input_size();
+        for (int k = 0; k < count; ++k) {
+            // Arrays with the alignment of the planned ones can be passed from any thread.
+            float *out = this->spectrum + k * spectrum_stride(n);
+            fftwf_execute_dft_r2c(this->plan, this->get_window_input(k), (fftwf_complex *)out);
+            this->set_spectrum(k, out[0], out[n], out + 2);
+        }
+    }
+
+private:
+    fftwf_plan plan;
+    std::vector<float> spectrum_data;
+    float *spectrum;
+};
+
+class FftwBackend : public FFTBackend
+{
+public:
+    FftwBackend()
+    {
+        std::lock_guard<std::mutex> lock(fftw_mutex);
+        static bool imported = false;
+        if (!imported) {
+            fftwf_import_system_wisdom();
+            imported = true;
+        }
+    }
+
+    ~FftwBackend() override
+    {
+        std::lock_guard<std::mutex> lock(fftw_mutex);
+        for (auto& plan : this->plans) {
+            fftwf_destroy_plan(plan.second);
+        }
+    }
+
+    std::unique_ptr<FFTPlan> create(int nbits, int batch) override
+    {
+        std::lock_guard<std::mutex> lock(fftw_mutex);
+        fftwf_plan& plan = this->plans[nbits];
+        if (!plan) {
+            // Measuring is only affordable ahead of time, e.g. with fftwf-wisdom.
+            int n = 1 << nbits;
+            float *in = fftwf_alloc_real(n);
+            fftwf_complex *out = fftwf_alloc_complex(n / 2 + 1);
+            plan = fftwf_plan_dft_r2c_1d(n, in, out, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+            if (!plan) {
+                plan = fftwf_plan_dft_r2c_1d(n, in, out, FFTW_ESTIMATE);
+            }
+            fftwf_free(out);
+            fftwf_free(in);
+        }
+        return std::unique_ptr<FFTPlan>(new FftwPlan(plan, nbits, batch));
+    }
+
+private:
+    std::map<int, fftwf_plan> plans;
+};
+#endif
+
+#if HAVE_DECL_AV_TX_FLOAT_RDFT
+struct TxContext
+{
+    AVTXContext *cx;
+    av_tx_fn fn;
+};
+
+// NULL if av_tx can't do the size or runs out of memory.
+static TxContext *avtx_init(int nbits)
+{
+    TxContext *tx = new TxContext();
+    float scale = 1.0f;
+    if (av_tx_init(&tx->cx, &tx->fn, AV_TX_FLOAT_RDFT, 0, 1 << nbits, &scale, 0) < 0 || !tx->fn) {
+        av_tx_uninit(&tx->cx);
+        delete tx;
+        return NULL;
+    }
+    return tx;
+}
+
+static void avtx_end(TxContext *tx)
+{
+    av_tx_uninit(&tx->cx);
+    delete tx;
+}
+
+class AvtxPlan : public FFTPlan
+{
+public:
+    AvtxPlan(ContextPool<TxContext>& pool, TxContext *tx, int nbits, int batch) :
+        FFTPlan(nbits, batch), pool(pool), nbits(nbits), tx(tx),
+        spectrum(aligned(this->spectrum_data, batch * spectrum_stride(1 << nbits))) {}
+    ~AvtxPlan() override { this->pool.give(this->nbits, this->tx); }
+
+    void execute_many(int count) override
+    {
+        int n = this->get_input_size();
+        for (int k = 0; k < count; ++k) {
+            float *out = this->spectrum + k * spectrum_stride(n);
+            this->tx->fn(this->tx->cx, out, this->get_window_input(k), sizeof(AVComplexFloat));
+            this->set_spectrum(k, out[0], out[n], out + 2);
+        }
+    }
+
+private:
+    ContextPool<TxContext>& pool;
+    int nbits;
+    TxContext *tx;
+    std::vector<float> spectrum_data;
+    float *spectrum;
+};
+
+class AvtxBackend : public FFTBackend
+{
+public:
+    AvtxBackend() : pool(avtx_init, avtx_end), fallback(create_fallback()) {}
+
+    std::unique_ptr<FFTPlan> create(int nbits, int batch) override
+    {
+        TxContext *tx = this->pool.take(nbits);
+        if (!tx) {
+            return this->fallback->create(nbits, batch);
+        }
+        return std::unique_ptr<FFTPlan>(new AvtxPlan(this->pool, tx, nbits, batch));
+    }
+
+private:
+    ContextPool<TxContext> pool;
+    std::unique_ptr<FFTBackend> fallback; // For sizes that fail to initialise.
+};
+#endif
+
+#if HAVE_LIBAVCODEC_AVFFT_H
+// NULL for sizes avfft can't do.
+static RDFTContext *avfft_init(int nbits)
+{
+    return av_rdft_init(nbits, DFT_R2C);
+}
+
+class AvfftPlan : public FFTPlan
+{
+public:
+    AvfftPlan(ContextPool<RDFTContext>& pool, RDFTContext *cx, int nbits, int batch) :
+        FFTPlan(nbits, batch), pool(pool), nbits(nbits), cx(cx) {}
+    ~AvfftPlan() override { this->pool.give(this->nbits, this->cx); }
+
+    void execute_many(int count) override
+    {
+        for (int k = 0; k < count; ++k) {
+            float *input = this->get_window_input(k);
+            av_rdft_calc(this->cx, input);
+            // RDFT packs the real Nyquist value next to the DC.
+            this->set_spectrum(k, input[0], input[1], input + 2);
+        }
+    }
+
+private:
+    ContextPool<RDFTContext>& pool;
+    int nbits;
+    RDFTContext *cx;
+};
+
+class AvfftBackend : public FFTBackend
+{
+public:
+    AvfftBackend() : pool(avfft_init, av_rdft_end), fallback(create_fallback()) {}
+
+    std::unique_ptr<FFTPlan> create(int nbits, int batch) override
+    {
+        RDFTContext *cx = this->pool.take(nbits);
+        if (!cx) {
+            return this->fallback->create(nbits, batch);
+        }
+        return std::unique_ptr<FFTPlan>(new AvfftPlan(this->pool, cx, nbits, batch));
+    }
+
+private:
+    ContextPool<RDFTContext> pool;
+    std::unique_ptr<FFTBackend> fallback;
+};
+#endif
+
+// Twiddle factors of a size, shared by all plans of it.
+struct BuiltinTables
+{
+    std::vector<int> reverse; // Bit reversal of the complex samples.
+    std::vector<double> twiddles; // exp(-2 pi i k / m) for the half size m transform.
+    std::vector<double> split; // exp(-2 pi i k / n) to untangle its output.
+};
+
+// Radix-2, the real samples are taken as half as many complex ones. No dependencies, but slower
+// than any of the libraries. It runs in double: in float the two halves of a sine, which end up
+// in Z[k] and Z[m - k], don't quite cancel out in the other bins.
+class BuiltinPlan : public FFTPlan
+{
+public:
+    BuiltinPlan(std::shared_ptr<const BuiltinTables> tables, int nbits, int batch) :
+        FFTPlan(nbits, batch), tables(tables), work(1 << nbits), bins(1 << nbits) {}
+
+    void execute_many(int count) override
+    {
+        for (int k = 0; k < count; ++k) {
+            this->transform(k);
+        }
+    }
+
+private:
+    void transform(int window)
+    {
+        int m = this->get_input_size() / 2;
+        const float *input = this->get_window_input(window);
+        double *a = this->work.data();
+        const int *reverse = this->tables->reverse.data();
+        for (int i = 0; i < m; ++i) {
+            int j = reverse[i];
+            a[2 * i] = input[2 * j];
+            a[2 * i + 1] = input[2 * j + 1];
+        }
+
+        const double *w = this->tables->twiddles.data();
+        for (int len = 2; len <= m; len <<= 1) {
+            int half = len / 2;
+            int step = m / len;
+            for (int i = 0; i < m; i += len) {
+                for (int j = 0; j < half; ++j) {
+                    double wr = w[2 * j * step];
+                    double wi = w[2 * j * step + 1];
+                    double *u = a + 2 * (i + j);
+                    double *v = u + 2 * half;
+                    double vr = v[0] * wr - v[1] * wi;
+                    double vi = v[0] * wi + v[1] * wr;
+                    v[0] = u[0] - vr;
+                    v[1] = u[1] - vi;
+                    u[0] += vr;
+                    u[1] += vi;
+                }
+            }
+        }
+
+        // Z[k] = E[k] + i O[k] holds the spectra of the even and odd samples, X[k] = E[k] + w^k O[k].
+        const double *s = this->tables->split.data();
+        float *bins = this->bins.data();
+        for (int j = 1; j < m; ++j) {
+            double er = 0.5 * (a[2 * j] + a[2 * (m - j)]);
+            double ei = 0.5 * (a[2 * j + 1] - a[2 * (m - j) + 1]);
+            double or_ = 0.5 * (a[2 * j + 1] + a[2 * (m - j) + 1]);
+            double oi = -0.5 * (a[2 * j] - a[2 * (m - j)]);
+            bins[2 * (j - 1)] = er + s[2 * j] * or_ - s[2 * j + 1] * oi;
+            bins[2 * (j - 1) + 1] = ei + s[2 * j] * oi + s[2 * j + 1] * or_;
+        }
+        this->set_spectrum(window, a[0] + a[1], a[0] - a[1], bins);
+    }
+
+    std::shared_ptr<const BuiltinTables> tables;
+    std::vector<double> work;
+    std::vector<float> bins;
+};
+
+class BuiltinBackend : public FFTBackend
+{
+public:
+    std::unique_ptr<FFTPlan> create(int nbits, int batch) override
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto& tables = this->tables[nbits];
+        if (!tables) {
+            tables = create_tables(nbits);
+        }
+        return std::unique_ptr<FFTPlan>(new BuiltinPlan(tables, nbits, batch));
+    }
+
+private:
+    static std::shared_ptr<const BuiltinTables> create_tables(int nbits)
+    {
+        std::shared_ptr<BuiltinTables> tables(new BuiltinTables());
+        int n = 1 << nbits;
+        int m = n / 2;
+        tables->reverse.resize(m);
+        for (int i = 0; i < m; ++i) {
+            int r = 0;
+            for (int b = 0; b < nbits - 1; ++b) {
+                r |= ((i >> b) & 1) << (nbits - 2 - b);
+            }
+            tables->reverse[i] = r;
+        }
+        for (int k = 0; k < m / 2; ++k) {
+            tables->twiddles.push_back(cos(-2.0 * M_PI * k / m));
+            tables->twiddles.push_back(sin(-2.0 * M_PI * k / m));
+        }
+        for (int k = 0; k < m; ++k) {
+            tables->split.push_back(cos(-2.0 * M_PI * k / n));
+            tables->split.push_back(sin(-2.0 * M_PI * k / n));
+        }
+        return tables;
+    }
+
+    std::mutex mutex;
+    std::map<int, std::shared_ptr<const BuiltinTables>> tables;
+};
+
+#if HAVE_OPENCL
+enum
+{
+    OPENCL_BATCH_FRAMES = 1 << 18, // Enough to make up for the copies to and from the device.
+};
+
+// The whole n point complex DFT of the real samples, in float. Unlike the half size one of
+// BuiltinPlan it has nothing to untangle, and the device spends less on the zeros than on doubles.
+// The second global id is the window of the batch.
+static const char *OPENCL_SOURCE = R"(
+__kernel void reorder(__global const float *input, __global const int *reverse, __global float2 *a)
+{
+    size_t window = get_global_id(1) * get_global_size(0);
+    a[window + get_global_id(0)] = (float2)(input[window + reverse[get_global_id(0)]], 0.0f);
+}
+
+// One stage of butterflies `span` values apart, each work item does one of them.
+__kernel void butterflies(__global float2 *a, __global const float2 *twiddles, int span)
+{
+    int n = 2 * get_global_size(0);
+    int k = get_global_id(0);
+    int j = k & (span - 1);
+    int i = (k - j) * 2 + j;
+    __global float2 *x = a + get_global_id(1) * n;
+    float2 w = twiddles[j * (n / (2 * span))];
+    float2 u = x[i];
+    float2 v = x[i + span];
+    v = (float2)(v.x * w.x - v.y * w.y, v.x * w.y + v.y * w.x);
+    x[i] = u + v;
+    x[i + span] = u - v;
+}
+
+__kernel void to_power(__global const float2 *a, __global float *output, float scale)
+{
+    int size = get_global_size(0);
+    float2 x = a[get_global_id(1) * 2 * (size - 1) + get_global_id(0)];
+    output[get_global_id(1) * size + get_global_id(0)] = (x.x * x.x + x.y * x.y) * scale;
+}
+)";
+
+static cl_device_id opencl_find_device()
+{
+    cl_uint count = 0;
+    if (clGetPlatformIDs(0, NULL, &count) != CL_SUCCESS || !count) {
+        return NULL;
+    }
+    std::vector<cl_platform_id> platforms(count);
+    clGetPlatformIDs(count, platforms.data(), NULL);
+    for (cl_platform_id platform : platforms) {
+        cl_device_id device;
+        if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL) == CL_SUCCESS) {
+            return device;
+        }
+    }
+    return NULL;
+}
+
+// The first GPU of any platform, NULL without one.
+static cl_device_id opencl_device()
+{
+    static cl_device_id device = opencl_find_device();
+    return device;
+}
+
+static bool opencl_available()
+{
+    return opencl_device() != NULL;
+}
+
+// Bit reversal and twiddle factors on the device, shared by all plans of a size.
+struct OpenclTables
+{
+    OpenclTables() : reverse(NULL), twiddles(NULL) {}
+    ~OpenclTables()
+    {
+        if (this->reverse) {
+            clReleaseMemObject(this->reverse);
+        }
+        if (this->twiddles) {
+            clReleaseMemObject(this->twiddles);
+        }
+    }
+
+    cl_mem reverse;
+    cl_mem twiddles; // exp(-2 pi i k / n).
+};
+
+// The windows are copied to the device and their power back, the FFTs of a batch run in parallel.
+class OpenclPlan : public FFTPlan
+{
+public:
+    OpenclPlan(cl_context context, cl_program program, std::shared_ptr<const OpenclTables> tables,
+        FFTBackend& fallback, int nbits, int batch) :
+        FFTPlan(nbits, batch), fallback(fallback), nbits(nbits), tables(tables), queue(NULL), input(NULL),
+        work(NULL), output(NULL), broken(false)
+    {
+        size_t n = this->get_input_size();
+        size_t size = this->get_output_size();
+        cl_int err = CL_SUCCESS;
+        this->queue = clCreateCommandQueue(context, opencl_device(), 0, &err);
+        size_t floats = (size_t)batch * n;
+        this->input = clCreateBuffer(context, CL_MEM_READ_ONLY, floats * sizeof(cl_float), NULL, &err);
+        this->work = clCreateBuffer(context, CL_MEM_READ_WRITE, floats * sizeof(cl_float2), NULL, &err);
+        floats = (size_t)batch * size;
+        this->output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, floats * sizeof(cl_float), NULL, &err);
+        this->kernels[0] = clCreateKernel(program, "reorder", &err);
+        this->kernels[1] = clCreateKernel(program, "butterflies", &err);
+        this->kernels[2] = clCreateKernel(program, "to_power", &err);
+        this->ready = this->queue && this->input && this->work && this->output &&
+            this->kernels[0] && this->kernels[1] && this->kernels[2];
+        if (!this->ready) {
+            return;
+        }
+        cl_float scale = 1.0f / ((float)n * n);
+        err = clSetKernelArg(this->kernels[0], 0, sizeof(cl_mem), &this->input);
+        err |= clSetKernelArg(this->kernels[0], 1, sizeof(cl_mem), &tables->reverse);
+        err |= clSetKernelArg(this->kernels[0], 2, sizeof(cl_mem), &this->work);
+        err |= clSetKernelArg(this->kernels[1], 0, sizeof(cl_mem), &this->work);
+        err |= clSetKernelArg(this->kernels[1], 1, sizeof(cl_mem), &tables->twiddles);
+        err |= clSetKernelArg(this->kernels[2], 0, sizeof(cl_mem), &this->work);
+        err |= clSetKernelArg(this->kernels[2], 1, sizeof(cl_mem), &this->output);
+        err |= clSetKernelArg(this->kernels[2], 2, sizeof(cl_float), &scale);
+        this->ready = err == CL_SUCCESS;
+    }
+
+    ~OpenclPlan() override
+    {
+        for (cl_kernel kernel : this->kernels) {
+            if (kernel) {
+                clReleaseKernel(kernel);
+            }
+        }
+        for (cl_mem buffer : {this->input, this->work, this->output}) {
+            if (buffer) {
+                clReleaseMemObject(buffer);
+            }
+        }
+        if (this->queue) {
+            clReleaseCommandQueue(this->queue);
+        }
+    }
+
+    bool is_ready() const { return this->ready; }
+
+    bool is_broken() const override { return this->broken; }
+
+    void execute_many(int count) override
+    {
+        size_t floats = (size_t)count * this->get_output_size();
+        if (!this->broken && this->enqueue(count) != CL_SUCCESS) {
+            // E.g. a lost device, the CPU takes over from this batch on rather than leave a gap.
+            clFinish(this->queue);
+            this->broken = true;
+            this->cpu = this->fallback.create(this->nbits, this->get_batch());
+        }
+        if (this->broken) {
+            size_t n = this->get_input_size();
+            std::copy(this->get_input(), this->get_input() + count * n, this->cpu->get_input());
+            this->cpu->set_power_output(this->get_power_output());
+            this->cpu->execute_many(count);
+            std::copy(this->cpu->get_output(), this->cpu->get_output() + floats, this->get_output());
+        } else if (!this->get_power_output()) {
+            spek_fft_power_to_db(this->get_output(), this->get_output(), floats, 1.0f);
+        }
+    }
+
+private:
+    // The first error, the queue runs the commands in order and only the last call blocks.
+    cl_int enqueue(int count)
+    {
+        size_t n = this->get_input_size();
+        size_t size = this->get_output_size();
+        cl_int err = clEnqueueWriteBuffer(
+            this->queue, this->input, CL_FALSE, 0, count * n * sizeof(cl_float), this->get_input(),
+            0, NULL, NULL
+        );
+        if (err != CL_SUCCESS) {
+            return err;
+        }
+        size_t reorder_size[] = {n, (size_t)count};
+        err = clEnqueueNDRangeKernel(
+            this->queue, this->kernels[0], 2, NULL, reorder_size, NULL, 0, NULL, NULL
+        );
+        size_t butterflies_size[] = {n / 2, (size_t)count};
+        for (cl_int span = 1; span < (cl_int)n && err == CL_SUCCESS; span *= 2) {
+            // Arguments are taken when the kernel is queued.
+            err = clSetKernelArg(this->kernels[1], 2, sizeof(cl_int), &span);
+            if (err == CL_SUCCESS) {
+                err = clEnqueueNDRangeKernel(
+                    this->queue, this->kernels[1], 2, NULL, butterflies_size, NULL, 0, NULL, NULL
+                );
+            }
+        }
+        if (err != CL_SUCCESS) {
+            return err;
+        }
+        size_t power_size[] = {size, (size_t)count};
+        err = clEnqueueNDRangeKernel(
+            this->queue, this->kernels[2], 2, NULL, power_size, NULL, 0, NULL, NULL
+        );
+        if (err != CL_SUCCESS) {
+            return err;
+        }
+        return clEnqueueReadBuffer(
+            this->queue, this->output, CL_TRUE, 0, count * size * sizeof(cl_float), this->get_output(),
+            0, NULL, NULL
+        );
+    }
+
+    FFTBackend& fallback;
+    int nbits;
+    std::shared_ptr<const OpenclTables> tables;
+    cl_command_queue queue;
+    // Their arguments can't be set from several threads, each plan has its own.
+    cl_kernel kernels[3];
+    cl_mem input;
+    cl_mem work;
+    cl_mem output;
+    bool ready;
+    bool broken;
+    std::unique_ptr<FFTPlan> cpu; // Of `fallback`, once the device failed.
+};
+
+// Runs on the first GPU. Plans that can't be set up on it, e.g. without enough memory for
+// a batch, run on the CPU instead, and so do those of a device that fails later on.
+class OpenclBackend : public FFTBackend
 {
 public:
-    FFTPlanImpl(int nbits);
-    ~FFTPlanImpl() override;
+    OpenclBackend() : context(NULL), program(NULL)
+    {
+        cl_device_id device = opencl_device();
+        cl_int err;
+        this->context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+        if (this->context) {
+            this->program = clCreateProgramWithSource(this->context, 1, &OPENCL_SOURCE, NULL, &err);
+        }
+        if (this->program && clBuildProgram(this->program, 1, &device, "", NULL, NULL) != CL_SUCCESS) {
+            clReleaseProgram(this->program);
+            this->program = NULL;
+        }
+    }
 
-    void execute() override;
+    ~OpenclBackend() override
+    {
+        this->tables.clear();
+        if (this->program) {
+            clReleaseProgram(this->program);
+        }
+        if (this->context) {
+            clReleaseContext(this->context);
+        }
+    }
+
+    std::unique_ptr<FFTPlan> create(int nbits, int batch) override
+    {
+        std::shared_ptr<const OpenclTables> tables;
+        if (this->program) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto& cached = this->tables[nbits];
+            if (!cached) {
+                cached = create_tables(this->context, nbits);
+            }
+            tables = cached;
+        }
+        if (tables) {
+            std::unique_ptr<OpenclPlan> plan(
+                new OpenclPlan(this->context, this->program, tables, this->fallback, nbits, batch)
+            );
+            if (plan->is_ready()) {
+                return std::unique_ptr<FFTPlan>(plan.release());
+            }
+        }
+        return this->fallback.create(nbits, batch);
+    }
+
+    int get_batch_frames() const override { return OPENCL_BATCH_FRAMES; }
 
 private:
-    struct RDFTContext *cx;
+    static std::shared_ptr<const OpenclTables> create_tables(cl_context context, int nbits)
+    {
+        int n = 1 << nbits;
+        std::vector<cl_int> reverse(n);
+        for (int i = 0; i < n; ++i) {
+            int r = 0;
+            for (int b = 0; b < nbits; ++b) {
+                r |= ((i >> b) & 1) << (nbits - 1 - b);
+            }
+            reverse[i] = r;
+        }
+        std::vector<cl_float> twiddles;
+        for (int k = 0; k < n / 2; ++k) {
+            twiddles.push_back(cos(-2.0 * M_PI * k / n));
+            twiddles.push_back(sin(-2.0 * M_PI * k / n));
+        }
+
+        std::shared_ptr<OpenclTables> tables(new OpenclTables());
+        cl_int err;
+        cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+        tables->reverse = clCreateBuffer(context, flags, n * sizeof(cl_int), reverse.data(), &err);
+        tables->twiddles = clCreateBuffer(context, flags, n * sizeof(cl_float), twiddles.data(), &err);
+        if (!tables->reverse || !tables->twiddles) {
+            return nullptr;
+        }
+        return tables;
+    }
+
+    cl_context context;
+    cl_program program;
+    std::mutex mutex;
+    std::map<int, std::shared_ptr<const OpenclTables>> tables;
+    BuiltinBackend fallback;
 };
+#endif
 
-std::unique_ptr<FFTPlan> FFT::create(int nbits)
+template<class T> static FFTBackend *create_backend()
 {
-    return std::unique_ptr<FFTPlan>(new FFTPlanImpl(nbits));
+    return new T();
 }
 
-FFTPlanImpl::FFTPlanImpl(int nbits) : FFTPlan(nbits), cx(av_rdft_init(nbits, DFT_R2C))
+// Plans of the sizes another backend fails to set up.
+static FFTBackend *create_fallback()
 {
+    return new BuiltinBackend();
 }
 
-FFTPlanImpl::~FFTPlanImpl()
+// The fastest first, then those that need a device, `available` tells if there is one.
+static const struct
+{
+    const char *name;
+    FFTBackend *(*create)();
+    bool (*available)();
+} BACKENDS[] = {
+#if HAVE_FFTW
+    {"fftw", create_backend<FftwBackend>, NULL},
+#endif
+#if HAVE_DECL_AV_TX_FLOAT_RDFT
+    {"avtx", create_backend<AvtxBackend>, NULL},
+#endif
+#if HAVE_LIBAVCODEC_AVFFT_H
+    {"avfft", create_backend<AvfftBackend>, NULL},
+#endif
+    {"builtin", create_backend<BuiltinBackend>, NULL},
+#if HAVE_OPENCL
+    {"opencl", create_backend<OpenclBackend>, opencl_available},
+#endif
+};
+
+FFT::FFT(const std::string& backend)
 {
-    av_rdft_end(this->cx);
+    int index = 0;
+    for (int i = 0; i < (int)(sizeof(BACKENDS) / sizeof(BACKENDS[0])); ++i) {
+        if (backend == BACKENDS[i].name && (!BACKENDS[i].available || BACKENDS[i].available())) {
+            index = i;
+        }
+    }
+    this->backend = BACKENDS[index].name;
+    this->impl.reset(BACKENDS[index].create());
 }
 
-void FFTPlanImpl::execute()
+FFT::~FFT()
 {
-    av_rdft_calc(this->cx, this->get_input());
+}
+
+std::vector<std::string> FFT::get_backends()
+{
+    std::vector<std::string> names;
+    for (const auto& backend : BACKENDS) {
+        if (!backend.available || backend.available()) {
+            names.push_back(backend.name);
+        }
+    }
+    return names;
+}
+
+std::unique_ptr<FFTPlan> FFT::create(int nbits, int batch)
+{
+    return this->impl->create(nbits, batch);
+}
 
-    // Calculate magnitudes.
-    int n = this->get_input_size();
-    float n2 = n * n;
-    this->set_output(0, 10.0f * log10f(this->get_input(0) * this->get_input(0) / n2));
-    this->set_output(n / 2, 10.0f * log10f(this->get_input(1) * this->get_input(1) / n2));
-    for (int i = 1; i < n / 2; i++) {
-        float re = this->get_input(i * 2);
-        float im = this->get_input(i * 2 + 1);
-        this->set_output(i, 10.0f * log10f((re * re + im * im) / n2));
+int FFT::get_batch_frames() const
+{
+    return this->impl->get_batch_frames();
+}
+
+FFTPlan::FFTPlan(int nbits, int batch) :
+    input_size(1 << nbits), output_size((1 << (nbits - 1)) + 1), batch(batch), power_output(false),
+    input(aligned(this->input_data, (size_t)batch * this->input_size)),
+    output((size_t)batch * this->output_size)
+{
+}
+
+void FFTPlan::set_spectrum(int window, float dc, float nyquist, const float *bins)
+{
+    int n = this->input_size;
+    float scale = 1.0f / ((float)n * n);
+    float *output = this->output.data() + (size_t)window * this->output_size;
+    output[0] = dc * dc * scale;
+    output[n / 2] = nyquist * nyquist * scale;
+    power(output + 1, bins, n / 2 - 1, scale);
+
+    if (!this->power_output) {
+        spek_fft_power_to_db(output, output, this->output_size, 1.0f);
+    }
+}
+
+// out[i] = (re * re + im * im) * scale for n interleaved complex values.
+static void power(float *out, const float *in, int n, float scale)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(in + 2 * i);
+        __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+        a = _mm_mul_ps(a, a);
+        b = _mm_mul_ps(b, b);
+        __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(re, im), vscale));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t vscale = vdupq_n_f32(scale);
+    for (; i + 4 <= n; i += 4) {
+        float32x4x2_t c = vld2q_f32(in + 2 * i);
+        float32x4_t p = vmlaq_f32(vmulq_f32(c.val[0], c.val[0]), c.val[1], c.val[1]);
+        vst1q_f32(out + i, vmulq_f32(p, vscale));
+    }
+#endif
+    for (; i < n; i++) {
+        float re = in[2 * i];
+        float im = in[2 * i + 1];
+        out[i] = (re * re + im * im) * scale;
+    }
+}
+
+// 10 * log10(2), converts log2 to dB.
+static const float DB_PER_LOG2 = 3.01029995664f;
+
+// log2(x) for normal positive x. The mantissa is moved into [sqrt(1/2), sqrt(2)) and
+// log2(m) = 2 / ln(2) * atanh(u), u = (m - 1) / (m + 1), is summed up to u^7. With |u| < 0.172
+// the truncation error is below 5e-8.
+static inline float fast_log2(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int e = (int)(bits >> 23) - 127;
+    bits = (bits & 0x7fffff) | 0x3f800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    if (m > (float)M_SQRT2) {
+        m *= 0.5f;
+        e++;
+    }
+    float u = (m - 1.0f) / (m + 1.0f);
+    float u2 = u * u;
+    float p = 1.0f + u2 * (1.0f / 3.0f + u2 * (1.0f / 5.0f + u2 * (1.0f / 7.0f)));
+    return e + u * p * (float)(2.0 / M_LN2);
+}
+
+void spek_fft_power_to_db(float *out, const float *in, int n, float scale)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 min = _mm_set1_ps(FLT_MIN);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 sqrt2 = _mm_set1_ps((float)M_SQRT2);
+    const __m128 ninf = _mm_set1_ps(-INFINITY);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(in + i), vscale);
+        __m128 is_zero = _mm_cmple_ps(x, zero);
+        __m128i bits = _mm_castps_si128(_mm_max_ps(x, min));
+        __m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+        __m128 m = _mm_castsi128_ps(_mm_or_si128(
+            _mm_and_si128(bits, _mm_set1_epi32(0x7fffff)), _mm_set1_epi32(0x3f800000)
+        ));
+        __m128 big = _mm_cmpgt_ps(m, sqrt2);
+        m = _mm_sub_ps(m, _mm_and_ps(big, _mm_mul_ps(m, half)));
+        e = _mm_sub_epi32(e, _mm_castps_si128(big));
+        __m128 u = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+        __m128 u2 = _mm_mul_ps(u, u);
+        __m128 p = _mm_add_ps(_mm_set1_ps(1.0f / 5.0f), _mm_mul_ps(u2, _mm_set1_ps(1.0f / 7.0f)));
+        p = _mm_add_ps(_mm_set1_ps(1.0f / 3.0f), _mm_mul_ps(u2, p));
+        p = _mm_add_ps(one, _mm_mul_ps(u2, p));
+        p = _mm_mul_ps(_mm_mul_ps(u, p), _mm_set1_ps((float)(2.0 / M_LN2)));
+        __m128 db = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(e), p), _mm_set1_ps(DB_PER_LOG2));
+        _mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(is_zero, ninf), _mm_andnot_ps(is_zero, db)));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t vscale = vdupq_n_f32(scale);
+    const float32x4_t min = vdupq_n_f32(FLT_MIN);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t ninf = vdupq_n_f32(-INFINITY);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vmulq_f32(vld1q_f32(in + i), vscale);
+        uint32x4_t is_zero = vcleq_f32(x, vdupq_n_f32(0.0f));
+        uint32x4_t bits = vreinterpretq_u32_f32(vmaxq_f32(x, min));
+        int32x4_t e = vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127));
+        float32x4_t m = vreinterpretq_f32_u32(
+            vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x7fffff)), vdupq_n_u32(0x3f800000))
+        );
+        uint32x4_t big = vcgtq_f32(m, vdupq_n_f32((float)M_SQRT2));
+        m = vbslq_f32(big, vmulq_f32(m, vdupq_n_f32(0.5f)), m);
+        e = vsubq_s32(e, vreinterpretq_s32_u32(big));
+        float32x4_t d = vaddq_f32(m, one);
+        float32x4_t r = vrecpeq_f32(d);
+        r = vmulq_f32(r, vrecpsq_f32(d, r));
+        r = vmulq_f32(r, vrecpsq_f32(d, r));
+        float32x4_t u = vmulq_f32(vsubq_f32(m, one), r);
+        float32x4_t u2 = vmulq_f32(u, u);
+        float32x4_t p = vmlaq_f32(vdupq_n_f32(1.0f / 5.0f), u2, vdupq_n_f32(1.0f / 7.0f));
+        p = vmlaq_f32(vdupq_n_f32(1.0f / 3.0f), u2, p);
+        p = vmlaq_f32(one, u2, p);
+        p = vmulq_f32(vmulq_f32(u, p), vdupq_n_f32((float)(2.0 / M_LN2)));
+        float32x4_t db = vmulq_f32(vaddq_f32(vcvtq_f32_s32(e), p), vdupq_n_f32(DB_PER_LOG2));
+        vst1q_f32(out + i, vbslq_f32(is_zero, ninf, db));
+    }
+#endif
+    for (; i < n; i++) {
+        float x = in[i] * scale;
+        out[i] = x > 0.0f ? DB_PER_LOG2 * fast_log2(x < FLT_MIN ? FLT_MIN : x) : -INFINITY;
     }
 }
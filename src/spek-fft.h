@@ -1,40 +1,89 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
 
+class FFTBackend;
 class FFTPlan;
 
+// Real DFTs of power of two sizes. Which library does them is picked when Spek is built, see
+// get_backends(), and can be changed at run time. What a backend sets up for a size is kept
+// until the FFT is destroyed, so the plans of the next file don't have to start from scratch.
 class FFT
 {
 public:
-    FFT() {}
-    std::unique_ptr<FFTPlan> create(int nbits);
+    // The fastest backend if `backend` is empty or not available.
+    FFT(const std::string& backend = "");
+    virtual ~FFT();
+
+    // Available backends, the fastest first. Those on other devices come last, they are only
+    // used when asked for and listed if there is a device to run on.
+    static std::vector<std::string> get_backends();
+    const std::string& get_backend() const { return this->backend; }
+    // Frames of the windows worth transforming per call, 0 unless the backend has to copy them
+    // to another device first and only pays off with large batches.
+    int get_batch_frames() const;
+
+    // Plans transform up to `batch` windows per call. Safe to call from any thread, the plans
+    // must be destroyed before the FFT.
+    virtual std::unique_ptr<FFTPlan> create(int nbits, int batch = 1);
+
+private:
+    std::string backend;
+    std::unique_ptr<FFTBackend> impl;
 };
 
 class FFTPlan
 {
 public:
-    FFTPlan(int nbits) :
-        input_size(1 << nbits), output_size((1 << (nbits - 1)) + 1),
-        input(input_size), output(output_size) {}
+    FFTPlan(int nbits, int batch = 1);
     virtual ~FFTPlan() {}
 
     int get_input_size() const { return this->input_size; }
     int get_output_size() const { return this->output_size; }
+    int get_batch() const { return this->batch; }
     float get_input(int i) const { return this->input[i]; }
     void set_input(int i, float v) { this->input[i] = v; }
+    float *get_input() { return this->input; }
     float get_output(int i) const { return this->output[i]; }
     void set_output(int i, float v) { this->output[i] = v; }
+    float *get_output() { return this->output.data(); }
+    // The windows of a batch follow each other, this one is aligned to 64 bytes.
+    float *get_window_input(int window) { return this->input + (size_t)window * this->input_size; }
+    const float *get_window_output(int window) const
+    {
+        return this->output.data() + (size_t)window * this->output_size;
+    }
+
+    // Output power, |X|^2 / N^2, instead of dB. Averaging several transforms is both cheaper and
+    // more accurate in the power domain, convert the result with spek_fft_power_to_db().
+    bool get_power_output() const { return this->power_output; }
+    void set_power_output(bool power_output) { this->power_output = power_output; }
 
-    virtual void execute() = 0;
+    void execute() { this->execute_many(1); }
+    // Transform the first `count` windows of the batch, their input is overwritten.
+    virtual void execute_many(int count) = 0;
+    // The backend failed and the builtin one transforms the windows instead, from the batch that
+    // failed on. Only a device can fail once it's set up.
+    virtual bool is_broken() const { return false; }
 
 protected:
-    float *get_input() { return this->input.data(); }
+    // For the backends: store the spectrum of a window, `bins` holds the complex values between
+    // the real DC and Nyquist ones, interleaved.
+    void set_spectrum(int window, float dc, float nyquist, const float *bins);
 
 private:
     int input_size;
     int output_size;
-    std::vector<float> input;
+    int batch;
+    bool power_output;
+    std::vector<float> input_data;
+    float *input;
     std::vector<float> output;
 };
+
+// out[i] = 10 * log10(in[i] * scale), using a fast approximation that is off by less than 5e-5 dB
+// anywhere, most of it rounding far below 0 dB. Values below FLT_MIN are clamped to it, zero maps to
+// -inf. `out` may be `in`.
+void spek_fft_power_to_db(float *out, const float *in, int n, float scale);
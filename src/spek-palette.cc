@@ -1,6 +1,12 @@
 #include <assert.h>
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "spek-palette.h"
 
 // Modified version of Dan Bruton's algorithm:
@@ -95,3 +101,54 @@ uint32_t spek_palette(enum palette palette, double level) {
         return 0;
     }
 }
+
+void spek_palette_lut(uint32_t *lut, enum palette palette)
+{
+    for (int i = 0; i < PALETTE_LUT_SIZE; ++i) {
+        lut[i] = spek_palette(palette, i / (double)(PALETTE_LUT_SIZE - 1));
+    }
+}
+
+void spek_palette_map(
+    uint32_t *out, const float *values, int n, const uint32_t *lut, float lrange, float urange
+) {
+    // index = round((clamp(value) - lrange) * scale), NAN and -inf map to `lrange`.
+    float scale = (PALETTE_LUT_SIZE - 1) / (urange - lrange);
+    float offset = 0.5f - lrange * scale;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 lo = _mm_set1_ps(lrange);
+    __m128 hi = _mm_set1_ps(urange);
+    __m128 s = _mm_set1_ps(scale);
+    __m128 o = _mm_set1_ps(offset);
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i), lo), hi);
+        __m128i index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, s), o));
+        alignas(16) int32_t k[4];
+        _mm_store_si128((__m128i*)k, index);
+        out[i] = lut[k[0]];
+        out[i + 1] = lut[k[1]];
+        out[i + 2] = lut[k[2]];
+        out[i + 3] = lut[k[3]];
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t lo = vdupq_n_f32(lrange);
+    float32x4_t hi = vdupq_n_f32(urange);
+    float32x4_t s = vdupq_n_f32(scale);
+    float32x4_t o = vdupq_n_f32(offset);
+    for (; i + 4 <= n; i += 4) {
+        // NAN survives the clamp but converts to index 0.
+        float32x4_t v = vminq_f32(vmaxq_f32(vld1q_f32(values + i), lo), hi);
+        int32x4_t index = vcvtq_s32_f32(vmlaq_f32(o, v, s));
+        out[i] = lut[vgetq_lane_s32(index, 0)];
+        out[i + 1] = lut[vgetq_lane_s32(index, 1)];
+        out[i + 2] = lut[vgetq_lane_s32(index, 2)];
+        out[i + 3] = lut[vgetq_lane_s32(index, 3)];
+    }
+#endif
+    for (; i < n; ++i) {
+        float v = values[i] > lrange ? values[i] : lrange;
+        v = v < urange ? v : urange;
+        out[i] = lut[(int)(v * scale + offset)];
+    }
+}
@@ -11,3 +11,15 @@ enum palette {
 };
 
 uint32_t spek_palette(enum palette palette, double level);
+
+enum {
+    PALETTE_LUT_SIZE = 4096, // Colours in a baked palette, fine enough for any dB range on screen.
+};
+
+// Bake `palette` into PALETTE_LUT_SIZE colours for levels evenly spread over [0, 1].
+void spek_palette_lut(uint32_t *lut, enum palette palette);
+
+// Map `n` dB values onto colours of a baked palette, clamping them to [`lrange`, `urange`].
+void spek_palette_map(
+    uint32_t *out, const float *values, int n, const uint32_t *lut, float lrange, float urange
+);
@@ -0,0 +1,255 @@
+#include <math.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "spek-pcm.h"
+
+enum
+{
+    WAVE_FORMAT_PCM = 1,
+    WAVE_FORMAT_IEEE_FLOAT = 3,
+    WAVE_FORMAT_EXTENSIBLE = 0xFFFE,
+};
+
+static unsigned le16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static unsigned be16(const unsigned char *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// The sample rate of AIFF is an 80-bit extended precision float.
+static double extended(const unsigned char *p)
+{
+    int exponent = (be16(p) & 0x7FFF) - 16383 - 63;
+    uint64_t mantissa = (uint64_t)be32(p + 2) << 32 | be32(p + 6);
+    return ldexp((double)mantissa, exponent);
+}
+
+// What can be read from the mapping, by the converters of AudioFile.
+static bool is_supported(const PcmFormat *format)
+{
+    if (format->channels <= 0 || format->sample_rate <= 0 || format->bits <= 0 ||
+        format->bits > format->bytes * 8) {
+        return false;
+    }
+    if (format->is_float) {
+        return !format->big_endian && (format->bytes == 4 || format->bytes == 8);
+    }
+    return format->bytes >= 2 && format->bytes <= 4;
+}
+
+// Frames of the data chunk at `offset`, a streamed file may have left its size at 0 or more
+// than there is.
+static int64_t data_frames(const PcmFormat *format, uint64_t chunk_size, uint64_t size)
+{
+    uint64_t available = size - format->offset;
+    if (!chunk_size || chunk_size > available) {
+        chunk_size = available;
+    }
+    return chunk_size / ((uint64_t)format->channels * format->bytes);
+}
+
+static bool parse_wav(const unsigned char *data, uint64_t size, PcmFormat *format)
+{
+    bool has_fmt = false;
+    uint64_t pos = 12;
+    while (pos + 8 <= size) {
+        const unsigned char *chunk = data + pos;
+        uint64_t chunk_size = le32(chunk + 4);
+        if (!memcmp(chunk, "fmt ", 4) && chunk_size >= 16 && pos + 8 + chunk_size <= size) {
+            unsigned tag = le16(chunk + 8);
+            format->channels = le16(chunk + 10);
+            format->sample_rate = le32(chunk + 12);
+            unsigned block_align = le16(chunk + 20);
+            format->bits = le16(chunk + 22);
+            format->bytes = (format->bits + 7) / 8;
+            if (tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40) {
+                // The samples take up as much as before, fewer of their bits may be used.
+                unsigned valid_bits = le16(chunk + 26);
+                tag = le16(chunk + 32);
+                if (valid_bits) {
+                    format->bits = valid_bits;
+                }
+            }
+            if (tag != WAVE_FORMAT_PCM && tag != WAVE_FORMAT_IEEE_FLOAT) {
+                return false;
+            }
+            if (block_align != (unsigned)format->channels * format->bytes) {
+                return false;
+            }
+            format->is_float = tag == WAVE_FORMAT_IEEE_FLOAT;
+            format->big_endian = false;
+            has_fmt = true;
+        } else if (!memcmp(chunk, "data", 4)) {
+            if (!has_fmt || !is_supported(format)) {
+                return false;
+            }
+            format->offset = pos + 8;
+            format->frames = data_frames(format, chunk_size == 0xFFFFFFFF ? 0 : chunk_size, size);
+            return true;
+        }
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    return false;
+}
+
+static bool parse_aiff(const unsigned char *data, uint64_t size, PcmFormat *format, bool aifc)
+{
+    bool has_comm = false;
+    int64_t frames = 0;
+    uint64_t pos = 12;
+    while (pos + 8 <= size) {
+        const unsigned char *chunk = data + pos;
+        uint64_t chunk_size = be32(chunk + 4);
+        if (!memcmp(chunk, "COMM", 4) && chunk_size >= (aifc ? 22 : 18) && pos + 8 + chunk_size <= size) {
+            format->channels = (int16_t)be16(chunk + 8);
+            frames = be32(chunk + 10);
+            format->bits = (int16_t)be16(chunk + 14);
+            format->bytes = (format->bits + 7) / 8;
+            double sample_rate = extended(chunk + 16);
+            format->sample_rate = sample_rate >= 1.0 && sample_rate < INT32_MAX ? (int)sample_rate : 0;
+            format->is_float = false;
+            format->big_endian = true;
+            // AIFF-C is only the same for uncompressed and byte swapped samples.
+            if (aifc && !memcmp(chunk + 26, "sowt", 4)) {
+                format->big_endian = false;
+            } else if (aifc && memcmp(chunk + 26, "NONE", 4)) {
+                return false;
+            }
+            has_comm = true;
+        } else if (!memcmp(chunk, "SSND", 4)) {
+            if (!has_comm || !is_supported(format) || chunk_size < 8 || pos + 16 > size) {
+                return false;
+            }
+            // The samples may start further in, e.g. to align them to blocks.
+            uint64_t skip = be32(chunk + 8);
+            format->offset = pos + 16 + skip;
+            if (format->offset > size) {
+                return false;
+            }
+            format->frames = data_frames(format, chunk_size >= 8 + skip ? chunk_size - 8 - skip : 0, size);
+            if (frames < format->frames) {
+                format->frames = frames;
+            }
+            return true;
+        }
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    return false;
+}
+
+bool spek_pcm_parse(const unsigned char *data, uint64_t size, PcmFormat *format)
+{
+    *format = PcmFormat();
+    if (size < 12) {
+        return false;
+    }
+    if (!memcmp(data, "RIFF", 4) && !memcmp(data + 8, "WAVE", 4)) {
+        return parse_wav(data, size, format);
+    }
+    if (!memcmp(data, "FORM", 4) && (!memcmp(data + 8, "AIFF", 4) || !memcmp(data + 8, "AIFC", 4))) {
+        return parse_aiff(data, size, format, !memcmp(data + 8, "AIFC", 4));
+    }
+    return false;
+}
+
+std::shared_ptr<PcmMapping> PcmMapping::open(const std::string& file_name)
+{
+    std::shared_ptr<PcmMapping> mapping(new PcmMapping());
+    mapping->map = NULL;
+    mapping->size = 0;
+#ifdef _WIN32
+    mapping->mapping = NULL;
+    HANDLE file = CreateFileA(
+        file_name.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (uint64_t)size.QuadPart <= SIZE_MAX) {
+        mapping->size = size.QuadPart;
+        mapping->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(file);
+    if (mapping->mapping) {
+        mapping->map = MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX) {
+        mapping->size = st.st_size;
+        mapping->map = mmap(NULL, mapping->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping->map == MAP_FAILED) {
+            mapping->map = NULL;
+        }
+    }
+    close(fd);
+#endif
+    if (!mapping->map) {
+        return nullptr;
+    }
+#ifdef MADV_SEQUENTIAL
+    // Read ahead further than usual, pages behind can go.
+    madvise(mapping->map, mapping->size, MADV_SEQUENTIAL);
+#endif
+    return mapping;
+}
+
+PcmMapping::~PcmMapping()
+{
+#ifdef _WIN32
+    if (this->map) {
+        UnmapViewOfFile(this->map);
+    }
+    if (this->mapping) {
+        CloseHandle(this->mapping);
+    }
+#else
+    if (this->map) {
+        munmap(this->map, this->size);
+    }
+#endif
+}
+
+void PcmMapping::will_read(uint64_t offset, uint64_t length) const
+{
+#ifdef MADV_WILLNEED
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0 || offset >= this->size) {
+        return;
+    }
+    uint64_t start = offset / page * page;
+    uint64_t end = offset + length < this->size ? offset + length : this->size;
+    madvise((char *)this->map + start, end - start, MADV_WILLNEED);
+#else
+    (void)offset;
+    (void)length;
+#endif
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+// How the samples of an uncompressed WAV or AIFF file are laid out. These are read straight from
+// the file, see PcmMapping, FFmpeg would only copy the bytes around.
+struct PcmFormat
+{
+    int channels;
+    int sample_rate;
+    int bits; // Significant bits of each sample.
+    int bytes; // Each sample takes up, the frames are interleaved.
+    bool is_float;
+    bool big_endian;
+    uint64_t offset; // Of the first frame in the file.
+    int64_t frames; // Per channel, only what the file really holds.
+};
+
+// Parses the header of a WAV or AIFF file of `size` bytes. Returns false if it's something else
+// or not plain PCM of 16 to 32-bit integers or 32 and 64-bit floats, FFmpeg handles those.
+bool spek_pcm_parse(const unsigned char *data, uint64_t size, PcmFormat *format);
+
+// A whole file mapped read-only into memory until the last reference is gone.
+class PcmMapping
+{
+public:
+    // Returns nullptr if the file can't be mapped, e.g. for lack of address space.
+    static std::shared_ptr<PcmMapping> open(const std::string& file_name);
+    ~PcmMapping();
+
+    const unsigned char *get_data() const { return (const unsigned char *)this->map; }
+    uint64_t get_size() const { return this->size; }
+    // The pages from `offset` on will be read in order, starting soon.
+    void will_read(uint64_t offset, uint64_t length) const;
+
+private:
+    PcmMapping() {}
+
+    void *map;
+    size_t size;
+#ifdef _WIN32
+    void *mapping;
+#endif
+};
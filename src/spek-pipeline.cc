@@ -1,16 +1,27 @@
 #include <wx/intl.h>
+#include <wx/thread.h>
 
 #include <assert.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <atomic>
 #include <vector>
 
 #include "spek-audio.h"
 #include "spek-fft.h"
+#include "spek-scale.h"
+#include "spek-utils.h"
 
 #include "spek-pipeline.h"
 
@@ -18,90 +29,277 @@
 
 enum
 {
-    NFFT = 64 // Number of FFTs to pre-fetch.
+    JOB_FRAMES = 1 << 16, // Frames processed by a single job, at most, unless the FFT wants more.
+    JOBS_PER_WORKER = 2, // Jobs in flight per worker thread.
+    SEGMENT_THREADS = 4, // Worker threads that keep up with one decoder.
+    MIN_SEGMENT_COLUMNS = 64, // Not worth opening the file again for less.
+    AUTO_FFTS = 8, // FFTs per column that OVERLAP_AUTO aims for.
+    BATCH_FRAMES = 1 << 14, // Frames of the windows transformed together, they stay in the cache.
+    MAX_BATCH = 16,
+};
+
+// A run of consecutive FFTs within one column, the windows are `hop` frames apart.
+struct spek_job
+{
+    int column;
+    int64_t end; // The frame following the first window.
+    int count;
+    bool done;
+};
+
+// Power accumulated for a column while its jobs are in flight.
+struct spek_column
+{
+    float *output; // Of each spectrum, see spectrum_values().
+    int num_fft;
+    int pending; // Jobs issued but not finished yet.
+    bool closed; // The last job of the column was issued.
+};
+
+// Nanoseconds each stage took so far, see spek_pipeline_stats. The threads add their share once
+// per block or job, nothing here is protected by a lock.
+struct spek_counters
+{
+    std::atomic<int64_t> frames{0};
+    std::atomic<int64_t> ffts{0};
+    std::atomic<int64_t> failed_ffts{0};
+    std::atomic<int64_t> columns{0};
+    std::atomic<int64_t> demux{0};
+    std::atomic<int64_t> decode{0};
+    std::atomic<int64_t> convert{0};
+    std::atomic<int64_t> copy{0};
+    std::atomic<int64_t> window{0};
+    std::atomic<int64_t> fft{0};
+    std::atomic<int64_t> deliver{0};
+    std::atomic<int64_t> reader_wait{0};
+    std::atomic<int64_t> worker_wait{0};
+    std::atomic<int> queue{0};
+};
+
+struct spek_worker
+{
+    struct spek_pipeline *p;
+    std::unique_ptr<FFTPlan> fft;
+    float *output; // Of each spectrum, see spectrum_values().
+    std::vector<float> values; // A column of each spectrum as it's delivered.
+    pthread_t thread;
+    bool has_thread;
 };
 
 struct spek_pipeline
 {
     std::unique_ptr<AudioFile> file;
-    std::unique_ptr<FFTPlan> fft;
     int stream;
     int channel;
+    int channels; // All channels of the file or just `channel`.
     enum window_function window_function;
+    int overlap;
+    int hop; // Frames between the windows of a column.
+    bool sparse; // One window per column, see spek_pipeline_set_sparse().
+    unsigned spectra_bits; // See spek_pipeline_set_spectra().
+    int spectra[SPECTRUM_COUNT]; // Where each spectrum is delivered, -1 if it's not.
+    int num_spectra;
     int samples;
+    int first; // Columns to analyse.
+    int last;
     spek_pipeline_cb cb;
     void *cb_data;
 
-    float *coss; // Pre-computed cos table.
+    float *window; // Pre-computed window coefficients.
     int nfft; // Size of the FFT transform.
+    int bands;
+    std::shared_ptr<const BandMap> band_map; // Folds the bands of each column into rows, if set.
     int input_size;
-    int input_pos;
-    float *input;
-    float *output;
+    float *input; // One ring of `input_size` frames per channel.
+
+    // Long ranges are split into segments decoded in parallel. Each one is a pipeline of its own
+    // reading a file from AudioFile::reopen(), this one only passes their columns on.
+    std::vector<struct spek_pipeline*> segments;
+    std::atomic<int> segments_running;
+
+    // The reader decodes into the input ring and cuts the stream into jobs, a pool of workers
+    // runs them in any order. A column is delivered by whichever worker finishes its last job.
+    // Everything below is protected by `mutex`. The reader takes it twice per decoded block and
+    // the workers once per job of thousands of frames, which is cheap enough that the ring needs
+    // no lock-free handoff of its own.
+    std::vector<spek_worker> workers;
+    int job_ffts; // FFTs per job, at most.
+    int num_jobs;
+    struct spek_job *jobs; // Ring of `num_jobs` jobs.
+    int64_t jobs_done; // All jobs before this one are finished.
+    int64_t jobs_taken; // All jobs before this one were picked up by a worker.
+    int64_t jobs_issued;
+    struct spek_column *columns; // Ring of `num_jobs + 1` columns in flight.
+    int column; // The column the reader is cutting into jobs.
+    int64_t column_start;
+    int64_t column_frames;
+    int column_fft; // FFTs of the current column already issued.
+    bool finished; // The reader issued all jobs.
+
+    struct spek_counters counters;
+    int64_t start_time; // spek_now() when started, 0 before.
+    std::atomic<int64_t> end_time; // When the last column was delivered, 0 before.
 
     pthread_t reader_thread;
     bool has_reader_thread;
-    pthread_mutex_t reader_mutex;
-    bool has_reader_mutex;
+    std::atomic<bool> reading; // The reader thread may be blocked in AudioFile::read().
+    pthread_mutex_t mutex;
+    bool has_mutex;
     pthread_cond_t reader_cond;
     bool has_reader_cond;
-    pthread_t worker_thread;
-    bool has_worker_thread;
-    pthread_mutex_t worker_mutex;
-    bool has_worker_mutex;
     pthread_cond_t worker_cond;
     bool has_worker_cond;
-    bool worker_done;
-    volatile bool quit;
+    std::atomic<bool> quit;
 };
 
 // Forward declarations.
 static void * reader_func(void *);
 static void * worker_func(void *);
-static void reader_sync(struct spek_pipeline *p, int pos);
+static float * create_window(enum window_function f, int n);
+static int64_t column_frame(const struct spek_pipeline *p, int64_t column);
+static int64_t next_window_end(const struct spek_pipeline *p);
+static int window_hop(const struct spek_pipeline *p, int overlap);
+static float * spectrum_values(const struct spek_pipeline *p, float *values, int spectrum);
+static void clear_spectra(const struct spek_pipeline *p, float *values);
+static void open_segments(struct spek_pipeline *p, FFT *fft, int fft_bits, int threads);
+static struct spek_pipeline * open_pipeline(
+    std::unique_ptr<AudioFile> file, FFT *fft, int fft_bits, int threads, int stream, int channel,
+    enum window_function window_function, int overlap, int samples, int first, int last,
+    int live_frames, spek_pipeline_cb cb, void *cb_data
+);
 
 struct spek_pipeline * spek_pipeline_open(
     std::unique_ptr<AudioFile> file,
-    std::unique_ptr<FFTPlan> fft,
+    FFT *fft,
+    int fft_bits,
+    int threads,
     int stream,
     int channel,
     enum window_function window_function,
+    int overlap,
     int samples,
+    int first,
+    int last,
+    spek_pipeline_cb cb,
+    void *cb_data
+)
+{
+    return open_pipeline(
+        std::move(file), fft, fft_bits, threads, stream, channel, window_function, overlap,
+        samples, first, last, 0, cb, cb_data
+    );
+}
+
+struct spek_pipeline * spek_pipeline_open_live(
+    std::unique_ptr<AudioFile> file,
+    FFT *fft,
+    int fft_bits,
+    int threads,
+    int channel,
+    enum window_function window_function,
+    int overlap,
+    int latency,
+    spek_pipeline_cb cb,
+    void *cb_data
+)
+{
+    int frames = spek_max(1, (int)((int64_t)file->get_sample_rate() * latency / 1000));
+    return open_pipeline(
+        std::move(file), fft, fft_bits, threads, 0, channel, window_function, overlap,
+        0, 0, INT32_MAX, frames, cb, cb_data
+    );
+}
+
+// Columns are `live_frames` frames long for live input, 0 to cut the file into `samples` columns.
+static struct spek_pipeline * open_pipeline(
+    std::unique_ptr<AudioFile> file,
+    FFT *fft,
+    int fft_bits,
+    int threads,
+    int stream,
+    int channel,
+    enum window_function window_function,
+    int overlap,
+    int samples,
+    int first,
+    int last,
+    int live_frames,
     spek_pipeline_cb cb,
     void *cb_data
 )
 {
     spek_pipeline *p = new spek_pipeline();
     p->file = std::move(file);
-    p->fft = std::move(fft);
     p->stream = stream;
     p->channel = channel;
     p->window_function = window_function;
+    p->sparse = false;
+    spek_pipeline_set_spectra(p, 1 << SPECTRUM_MEAN);
     p->samples = samples;
+    p->first = spek_max(0, first);
+    p->last = last;
     p->cb = cb;
     p->cb_data = cb_data;
 
-    p->coss = NULL;
+    p->window = NULL;
     p->input = NULL;
-    p->output = NULL;
+    p->jobs = NULL;
+    p->columns = NULL;
     p->has_reader_thread = false;
-    p->has_reader_mutex = false;
+    p->reading = false;
+    p->has_mutex = false;
     p->has_reader_cond = false;
-    p->has_worker_thread = false;
-    p->has_worker_mutex = false;
     p->has_worker_cond = false;
+    p->start_time = 0;
+    p->end_time = 0;
 
     if (!p->file->get_error()) {
-        p->nfft = p->fft->get_input_size();
-        p->coss = (float*)malloc(p->nfft * sizeof(float));
-        float cf = 2.0f * (float)M_PI / (p->nfft - 1.0f);
-        for (int i = 0; i < p->nfft; ++i) {
-            p->coss[i] = cosf(cf * i);
+        p->channels = channel == AUDIO_ALL_CHANNELS ? p->file->get_channels() : 1;
+        if (threads <= 0) {
+            threads = spek_max(1, wxThread::GetCPUCount());
+        }
+        p->nfft = 1 << fft_bits;
+        p->bands = p->nfft / 2 + 1;
+        if (live_frames) {
+            p->file->start_live(channel, live_frames);
+        } else {
+            p->file->start(channel, samples);
+        }
+        p->overlap = overlap;
+        p->hop = window_hop(p, overlap);
+        if (!live_frames) {
+            open_segments(p, fft, fft_bits, threads);
+        }
+    }
+
+    if (!p->file->get_error() && p->segments.empty()) {
+        // Backends on another device want all of a job in one go, the CPU ones a batch in the cache.
+        int device_frames = fft->get_batch_frames();
+        int batch = device_frames ? device_frames / p->nfft : spek_min(MAX_BATCH, BATCH_FRAMES / p->nfft);
+        p->workers.resize(threads);
+        for (auto& worker : p->workers) {
+            worker.p = p;
+            worker.fft = fft->create(fft_bits, spek_max(1, batch));
+            // FFTs are averaged as power, the average is converted to dB once per interval.
+            worker.fft->set_power_output(true);
+            worker.output = NULL;
+            worker.has_thread = false;
+        }
+        p->window = create_window(window_function, p->nfft);
+
+        p->job_ffts = spek_max(1, spek_max(JOB_FRAMES, device_frames) / (p->nfft * p->channels));
+        p->num_jobs = JOBS_PER_WORKER * threads;
+        p->jobs = (struct spek_job*)calloc(p->num_jobs, sizeof(struct spek_job));
+        // Their outputs are allocated once the spectra are known.
+        p->columns = (struct spek_column*)calloc(p->num_jobs + 1, sizeof(struct spek_column));
+
+        // Room for all jobs in flight, one more being filled and the look-behind of its windows.
+        p->input_size = (p->num_jobs + 1) * p->job_ffts * p->nfft + 2 * p->nfft;
+        p->input = (float*)calloc(p->input_size * p->channels, sizeof(float));
+        // Windows of the first column may reach back `nfft` frames.
+        if (p->first > 0) {
+            p->file->seek(spek_max64(0, column_frame(p, p->first) - p->nfft));
         }
-        p->input_size = p->nfft * (NFFT * 2 + 1);
-        p->input = (float*)malloc(p->input_size * sizeof(float));
-        p->output = (float*)malloc(p->fft->get_output_size() * sizeof(float));
-        p->file->start(channel, samples);
     }
 
     return p;
@@ -112,26 +310,104 @@ void spek_pipeline_start(struct spek_pipeline *p)
     if (!!p->file->get_error()) {
         return;
     }
+    p->start_time = spek_now();
+    if (!p->segments.empty()) {
+        p->segments_running = p->segments.size();
+        for (auto segment : p->segments) {
+            spek_pipeline_start(segment);
+        }
+        return;
+    }
 
-    p->input_pos = 0;
-    p->worker_done = false;
+    p->jobs_done = 0;
+    p->jobs_taken = 0;
+    p->jobs_issued = 0;
+    p->column = p->first;
+    p->column_start = column_frame(p, p->first);
+    p->column_frames = column_frame(p, p->first + 1) - p->column_start;
+    p->column_fft = 0;
+    p->finished = false;
     p->quit = false;
 
-    p->has_reader_mutex = !pthread_mutex_init(&p->reader_mutex, NULL);
+    int size = p->bands * p->channels * p->num_spectra;
+    int bands = p->band_map ? p->band_map->get_rows() : p->bands;
+    for (auto& worker : p->workers) {
+        worker.output = (float*)malloc(size * sizeof(float));
+        worker.values.resize(bands * p->num_spectra);
+    }
+    for (int i = 0; i < p->num_jobs + 1; ++i) {
+        p->columns[i].output = (float*)malloc(size * sizeof(float));
+        clear_spectra(p, p->columns[i].output);
+    }
+
+    p->has_mutex = !pthread_mutex_init(&p->mutex, NULL);
     p->has_reader_cond = !pthread_cond_init(&p->reader_cond, NULL);
-    p->has_worker_mutex = !pthread_mutex_init(&p->worker_mutex, NULL);
     p->has_worker_cond = !pthread_cond_init(&p->worker_cond, NULL);
 
+    p->reading = true;
     p->has_reader_thread = !pthread_create(&p->reader_thread, NULL, &reader_func, p);
     if (!p->has_reader_thread) {
         spek_pipeline_close(p);
     }
 }
 
-void spek_pipeline_close(struct spek_pipeline *p)
+void spek_pipeline_set_band_map(struct spek_pipeline *p, std::shared_ptr<const BandMap> band_map)
+{
+    p->band_map = band_map;
+    for (auto segment : p->segments) {
+        spek_pipeline_set_band_map(segment, band_map);
+    }
+}
+
+void spek_pipeline_set_sparse(struct spek_pipeline *p, bool sparse)
+{
+    p->sparse = sparse;
+    for (auto segment : p->segments) {
+        spek_pipeline_set_sparse(segment, sparse);
+    }
+}
+
+void spek_pipeline_set_spectra(struct spek_pipeline *p, unsigned spectra)
+{
+    // At least one of them.
+    spectra &= (1u << SPECTRUM_COUNT) - 1;
+    p->spectra_bits = spectra ? spectra : 1u << SPECTRUM_MEAN;
+    p->num_spectra = 0;
+    for (int i = 0; i < SPECTRUM_COUNT; ++i) {
+        p->spectra[i] = p->spectra_bits & (1u << i) ? p->num_spectra++ : -1;
+    }
+    for (auto segment : p->segments) {
+        spek_pipeline_set_spectra(segment, spectra);
+    }
+}
+
+void spek_pipeline_cancel(struct spek_pipeline *p)
 {
+    for (auto segment : p->segments) {
+        spek_pipeline_cancel(segment);
+    }
     if (p->has_reader_thread) {
+        // Wake up everyone who is asleep, they will see `quit` and bail out.
+        pthread_mutex_lock(&p->mutex);
         p->quit = true;
+        pthread_cond_signal(&p->reader_cond);
+        pthread_cond_broadcast(&p->worker_cond);
+        pthread_mutex_unlock(&p->mutex);
+        if (p->reading) {
+            p->file->interrupt();
+        }
+    }
+}
+
+std::unique_ptr<AudioFile> spek_pipeline_close(struct spek_pipeline *p)
+{
+    // All segments stop at once, then they are waited for one by one.
+    spek_pipeline_cancel(p);
+    for (auto segment : p->segments) {
+        spek_pipeline_close(segment);
+    }
+    p->segments.clear();
+    if (p->has_reader_thread) {
         pthread_join(p->reader_thread, NULL);
         p->has_reader_thread = false;
     }
@@ -139,96 +415,86 @@ void spek_pipeline_close(struct spek_pipeline *p)
         pthread_cond_destroy(&p->worker_cond);
         p->has_worker_cond = false;
     }
-    if (p->has_worker_mutex) {
-        pthread_mutex_destroy(&p->worker_mutex);
-        p->has_worker_mutex = false;
-    }
     if (p->has_reader_cond) {
         pthread_cond_destroy(&p->reader_cond);
         p->has_reader_cond = false;
     }
-    if (p->has_reader_mutex) {
-        pthread_mutex_destroy(&p->reader_mutex);
-        p->has_reader_mutex = false;
+    if (p->has_mutex) {
+        pthread_mutex_destroy(&p->mutex);
+        p->has_mutex = false;
+    }
+    if (p->columns) {
+        for (int i = 0; i < p->num_jobs + 1; ++i) {
+            free(p->columns[i].output);
+        }
+        free(p->columns);
+        p->columns = NULL;
+    }
+    if (p->jobs) {
+        free(p->jobs);
+        p->jobs = NULL;
     }
-    if (p->output) {
-        free(p->output);
-        p->output = NULL;
+    for (auto& worker : p->workers) {
+        free(worker.output);
     }
+    p->workers.clear();
     if (p->input) {
         free(p->input);
         p->input = NULL;
     }
-    if (p->coss) {
-        free(p->coss);
-        p->coss = NULL;
+    if (p->window) {
+        free(p->window);
+        p->window = NULL;
     }
 
-    p->file.reset();
+    auto file = std::move(p->file);
 
     delete p;
+    return file;
 }
 
-std::string spek_pipeline_desc(const struct spek_pipeline *pipeline)
+// `analysis` lists what the pipeline adds about the FFTs.
+static std::string file_desc(
+    const AudioFile& file, int stream, int channel, const std::vector<std::string>& analysis)
 {
     std::vector<std::string> items;
 
-    if (!pipeline->file->get_codec_name().empty()) {
-        items.push_back(pipeline->file->get_codec_name());
+    if (!file.get_codec_name().empty()) {
+        items.push_back(file.get_codec_name());
     }
 
-    if (pipeline->file->get_bit_rate()) {
+    if (file.get_bit_rate()) {
         items.push_back(std::string(
-            wxString::Format(_("%d kbps"), (pipeline->file->get_bit_rate() + 500) / 1000).utf8_str()
+            wxString::Format(_("%d kbps"), (file.get_bit_rate() + 500) / 1000).utf8_str()
         ));
     }
 
-    if (pipeline->file->get_sample_rate()) {
+    if (file.get_sample_rate()) {
         items.push_back(std::string(
-            wxString::Format(_("%d Hz"), pipeline->file->get_sample_rate()).utf8_str()
+            wxString::Format(_("%d Hz"), file.get_sample_rate()).utf8_str()
         ));
     }
 
     // Include bits per sample only if there is no bitrate.
-    if (pipeline->file->get_bits_per_sample() && !pipeline->file->get_bit_rate()) {
+    if (file.get_bits_per_sample() && !file.get_bit_rate()) {
         items.push_back(std::string(
             wxString::Format(
-                ngettext("%d bit", "%d bits", pipeline->file->get_bits_per_sample()),
-                pipeline->file->get_bits_per_sample()
+                ngettext("%d bit", "%d bits", file.get_bits_per_sample()),
+                file.get_bits_per_sample()
             ).utf8_str()
         ));
     }
 
-    if (pipeline->file->get_channels()) {
+    if (file.get_channels()) {
         items.push_back(std::string(
             wxString::Format(
                 // TRANSLATORS: first %d is the current channel, second %d is the total number.
-                "channel %d / %d", pipeline->channel + 1, pipeline->file->get_channels()
+                "channel %d / %d", channel + 1, file.get_channels()
             ).utf8_str()
         ));
     }
 
-    if (pipeline->file->get_error() == AudioError::OK) {
-        items.push_back(std::string(wxString::Format(wxT("W:%i"), pipeline->nfft).utf8_str()));
-
-        std::string window_function_name;
-        switch (pipeline->window_function) {
-        case WINDOW_HANN:
-            window_function_name = std::string("Hann");
-            break;
-        case WINDOW_HAMMING:
-            window_function_name = std::string("Hamming");
-            break;
-        case WINDOW_BLACKMAN_HARRIS:
-            window_function_name = std::string("Blackman–Harris");
-            break;
-        default:
-            assert(false);
-        }
-        if (window_function_name.size()) {
-            items.push_back("F:" + window_function_name);
-        }
-    }
+    items.insert(items.end(), analysis.begin(), analysis.end());
 
     std::string desc;
     for (const auto& item : items) {
@@ -239,7 +505,7 @@ std::string spek_pipeline_desc(const struct spek_pipeline *pipeline)
     }
 
     wxString error;
-    switch (pipeline->file->get_error()) {
+    switch (file.get_error()) {
     case AudioError::CANNOT_OPEN_FILE:
         error = _("Cannot open input file");
         break;
@@ -274,13 +540,13 @@ std::string spek_pipeline_desc(const struct spek_pipeline *pipeline)
     auto error_string = std::string(error.utf8_str());
     if (desc.empty()) {
         desc = error_string;
-    } else if (pipeline->stream < pipeline->file->get_streams()) {
+    } else if (stream < file.get_streams()) {
         desc = std::string(
             wxString::Format(
                 // TRANSLATORS: first %d is the stream number, second %d is the
                 // total number of streams, %s is the stream description.
                 _("Stream %d / %d: %s"),
-                pipeline->stream + 1, pipeline->file->get_streams(), desc.c_str()
+                stream + 1, file.get_streams(), desc.c_str()
             ).utf8_str()
         );
     } else if (!error_string.empty()) {
@@ -293,6 +559,43 @@ std::string spek_pipeline_desc(const struct spek_pipeline *pipeline)
     return desc;
 }
 
+std::string spek_file_desc(const AudioFile& file, int stream, int channel)
+{
+    return file_desc(file, stream, channel, std::vector<std::string>());
+}
+
+std::string spek_pipeline_desc(const struct spek_pipeline *pipeline, int channel)
+{
+    std::vector<std::string> analysis;
+    if (pipeline->file->get_error() == AudioError::OK) {
+        analysis.push_back(std::string(wxString::Format(wxT("W:%i"), pipeline->nfft).utf8_str()));
+        if (pipeline->hop < pipeline->nfft) {
+            int overlap = 100 - (int)((int64_t)pipeline->hop * 100 / pipeline->nfft);
+            analysis.push_back(std::string(wxString::Format(wxT("O:%i%%"), overlap).utf8_str()));
+        }
+
+        std::string window_function_name;
+        switch (pipeline->window_function) {
+        case WINDOW_HANN:
+            window_function_name = std::string("Hann");
+            break;
+        case WINDOW_HAMMING:
+            window_function_name = std::string("Hamming");
+            break;
+        case WINDOW_BLACKMAN_HARRIS:
+            window_function_name = std::string("Blackman–Harris");
+            break;
+        default:
+            assert(false);
+        }
+        if (window_function_name.size()) {
+            analysis.push_back("F:" + window_function_name);
+        }
+    }
+
+    return file_desc(*pipeline->file, pipeline->stream, channel, analysis);
+}
+
 int spek_pipeline_streams(const struct spek_pipeline *pipeline)
 {
     return pipeline->file->get_streams();
@@ -313,155 +616,560 @@ int spek_pipeline_sample_rate(const struct spek_pipeline *pipeline)
     return pipeline->file->get_sample_rate();
 }
 
+static void add_stats(struct spek_pipeline_stats *stats, const struct spek_pipeline *p)
+{
+    for (auto segment : p->segments) {
+        add_stats(stats, segment);
+    }
+    const struct spek_counters& counters = p->counters;
+    stats->frames += counters.frames;
+    stats->ffts += counters.ffts;
+    stats->failed_ffts += counters.failed_ffts;
+    stats->columns += counters.columns;
+    stats->demux += counters.demux * 1e-9;
+    stats->decode += counters.decode * 1e-9;
+    stats->convert += counters.convert * 1e-9;
+    stats->copy += counters.copy * 1e-9;
+    stats->window += counters.window * 1e-9;
+    stats->fft += counters.fft * 1e-9;
+    stats->deliver += counters.deliver * 1e-9;
+    stats->reader_wait += counters.reader_wait * 1e-9;
+    stats->worker_wait += counters.worker_wait * 1e-9;
+    stats->queue += counters.queue;
+    stats->max_queue += p->jobs ? p->num_jobs : 0;
+    stats->threads += (int)p->workers.size();
+}
+
+struct spek_pipeline_stats spek_pipeline_get_stats(const struct spek_pipeline *pipeline)
+{
+    struct spek_pipeline_stats stats = spek_pipeline_stats();
+    add_stats(&stats, pipeline);
+    if (pipeline->start_time) {
+        int64_t end = pipeline->end_time ? (int64_t)pipeline->end_time : spek_now();
+        stats.elapsed = (end - pipeline->start_time) * 1e-9;
+    }
+    return stats;
+}
+
+std::string spek_pipeline_format_stats(const struct spek_pipeline_stats& stats)
+{
+    double elapsed = stats.elapsed > 0.0 ? stats.elapsed : 1.0;
+    char failed[64] = "";
+    if (stats.failed_ffts) {
+        snprintf(failed, sizeof(failed), " (%lld on the CPU after errors)", (long long)stats.failed_ffts);
+    }
+    char line[576];
+    snprintf(
+        line, sizeof(line),
+        "%.2f s, %lld columns (%.0f/s), %.2f M frames/s, %lld FFTs%s; "
+        "demux %.2f s, decode %.2f s, convert %.2f s, copy %.2f s; "
+        "window %.2f s, FFT %.2f s, deliver %.2f s; "
+        "reader waited %.2f s, workers %.2f s (%d threads); queue %d/%d",
+        stats.elapsed, (long long)stats.columns, stats.columns / elapsed, stats.frames / elapsed * 1e-6,
+        (long long)stats.ffts, failed,
+        stats.demux, stats.decode, stats.convert, stats.copy,
+        stats.window, stats.fft, stats.deliver,
+        stats.reader_wait, stats.worker_wait, stats.threads, stats.queue, stats.max_queue
+    );
+    return line;
+}
+
+// The first frame of `column`, intervals are `frames_per_interval` frames long
+// plus the accumulated error, so that they add up to the whole file.
+static int64_t column_frame(const struct spek_pipeline *p, int64_t column)
+{
+    int64_t error = p->file->get_error_per_interval();
+    int64_t base = p->file->get_error_base();
+    int64_t extra = error && column > INT64_MAX / error ?
+        (int64_t)((long double)column * error / base) : column * error / base;
+    return column * p->file->get_frames_per_interval() + extra;
+}
+
+// Windows overlap by `overlap` percent. OVERLAP_AUTO only overlaps them in columns that would
+// get less than AUTO_FFTS windows otherwise, long columns cost no more than before.
+static int window_hop(const struct spek_pipeline *p, int overlap)
+{
+    int min_hop = spek_max(1, p->nfft * (100 - MAX_OVERLAP) / 100);
+    if (overlap == OVERLAP_AUTO) {
+        int64_t frames = p->file->get_frames_per_interval();
+        return (int)spek_max64(min_hop, spek_min64(p->nfft, (frames - p->nfft) / (AUTO_FFTS - 1)));
+    }
+    return spek_max(min_hop, p->nfft * (100 - spek_max(0, overlap)) / 100);
+}
+
+static void segment_cb(int bands, int channel, int sample, float *values, void *cb_data)
+{
+    struct spek_pipeline *p = (spek_pipeline*)cb_data;
+    if (sample != -1) {
+        p->cb(bands, channel, sample, values, p->cb_data);
+    } else if (!--p->segments_running) {
+        p->end_time = spek_now();
+        p->cb(bands, -1, -1, NULL, p->cb_data);
+    }
+}
+
+// Decoding runs on a single thread, give every SEGMENT_THREADS workers a decoder of their own
+// by splitting the range. Each segment seeks to just before its first column, so the columns
+// come out the same as if it was read in one go.
+static void open_segments(struct spek_pipeline *p, FFT *fft, int fft_bits, int threads)
+{
+    int end = spek_min(p->last, p->samples);
+    int count = spek_min(threads / SEGMENT_THREADS, (end - p->first) / MIN_SEGMENT_COLUMNS);
+    if (count < 2) {
+        return;
+    }
+    std::vector<std::unique_ptr<AudioFile>> files;
+    for (int i = 0; i < count; ++i) {
+        auto file = p->file->reopen();
+        if (!file || !!file->get_error()) {
+            return;
+        }
+        files.push_back(std::move(file));
+    }
+
+    for (int i = 0; i < count; ++i) {
+        int first = p->first + (int)((int64_t)(end - p->first) * i / count);
+        int last = i + 1 < count ? p->first + (int)((int64_t)(end - p->first) * (i + 1) / count) : p->last;
+        p->segments.push_back(spek_pipeline_open(
+            std::move(files[i]), fft, fft_bits, threads / count, p->stream, p->channel,
+            p->window_function, p->overlap, p->samples, first, last, segment_cb, p
+        ));
+    }
+}
+
+// The frame following the next window the reader will issue. Columns that are shorter than
+// the window use a single FFT of the last `nfft` frames, reaching into the previous columns.
+static int64_t next_window_end(const struct spek_pipeline *p)
+{
+    if (p->column_frames < p->nfft) {
+        return p->column_start + p->column_frames;
+    }
+    if (p->sparse) {
+        return p->column_start + (p->column_frames + p->nfft) / 2;
+    }
+    return p->column_start + p->nfft + p->column_fft * p->hop;
+}
+
+// The first frame that is still needed: either by the oldest unfinished job
+// or by the next window the reader will issue.
+static int64_t reader_tail(struct spek_pipeline *p)
+{
+    if (p->jobs_done < p->jobs_issued) {
+        return p->jobs[p->jobs_done % p->num_jobs].end - p->nfft;
+    }
+    return next_window_end(p) - p->nfft;
+}
+
+// Cut the data up to `head` into jobs. Returns false when nothing else can be issued without
+// more data, true when the job ring is full. Requires `mutex`.
+static bool reader_schedule(struct spek_pipeline *p, int64_t head)
+{
+    if (!p->file->get_frames_per_interval()) {
+        // Less frames than columns, such intervals are never complete.
+        return false;
+    }
+
+    int issued = 0;
+    bool full;
+    while (!(full = p->jobs_issued - p->jobs_done == p->num_jobs) && p->column < p->last) {
+        int64_t column_end = p->column_start + p->column_frames;
+        int total = p->sparse || p->column_frames < p->nfft ? 1 : 1 + (p->column_frames - p->nfft) / p->hop;
+        int64_t end = next_window_end(p);
+        int64_t available = end > head ? 0 : 1 + (head - end) / p->hop;
+        int count = spek_min(spek_min(total - p->column_fft, available), p->job_ffts);
+
+        // The last job closes the column, hold it back until the whole interval is here.
+        // Skimming never reads all of it.
+        bool last = p->column_fft + count == total;
+        if (last && !p->sparse && column_end > head) {
+            count--;
+            last = false;
+        }
+        if (!count) {
+            break;
+        }
+
+        struct spek_job *job = &p->jobs[p->jobs_issued++ % p->num_jobs];
+        job->column = p->column;
+        job->end = end;
+        job->count = count;
+        job->done = false;
+        struct spek_column *column = &p->columns[p->column % (p->num_jobs + 1)];
+        column->pending++;
+        p->column_fft += count;
+        issued++;
+
+        if (last) {
+            column->closed = true;
+            p->column++;
+            p->column_start = column_end;
+            p->column_frames = column_frame(p, p->column + 1) - column_end;
+            p->column_fft = 0;
+        }
+    }
+
+    if (issued) {
+        p->counters.queue = p->jobs_issued - p->jobs_done;
+        pthread_cond_broadcast(&p->worker_cond);
+    }
+    return full;
+}
+
 static void * reader_func(void *pp)
 {
     struct spek_pipeline *p = (spek_pipeline*)pp;
 
-    p->has_worker_thread = !pthread_create(&p->worker_thread, NULL, &worker_func, p);
-    if (!p->has_worker_thread) {
-        return NULL;
+    for (auto& worker : p->workers) {
+        worker.has_thread = !pthread_create(&worker.thread, NULL, &worker_func, &worker);
     }
 
-    int pos = 0, prev_pos = 0;
+    // Reading stops once the last column is issued, only the reader thread touches `column`.
+    int64_t head = p->first > 0 ? spek_max64(0, p->column_start - p->nfft) : 0;
+    AudioTimes times = p->file->get_times();
     int len;
-    while ((len = p->file->read()) > 0) {
-        if (p->quit) break;
+    while (!p->quit && p->column < p->last) {
+        // Skimming goes straight to the next window.
+        int64_t skip = p->sparse ? next_window_end(p) - p->nfft - head : 0;
+        if (skip > 0) {
+            p->file->seek(head + skip);
+            head += skip;
+        }
+        len = p->file->read();
+        AudioTimes last = times;
+        times = p->file->get_times();
+        p->counters.demux += times.demux - last.demux;
+        p->counters.decode += times.decode - last.decode;
+        p->counters.convert += times.convert - last.convert;
+        if (len <= 0) {
+            break;
+        }
+        p->counters.frames += len;
+        int pos = 0;
+        while (pos < len && !p->quit && p->column < p->last) {
+            if (p->sparse) {
+                // Drop what comes before the next window, or the rest of the block if it's not in it.
+                skip = next_window_end(p) - p->nfft - head;
+                if (skip >= len - pos) {
+                    break;
+                }
+                if (skip > 0) {
+                    pos += skip;
+                    head += skip;
+                }
+            }
+            int64_t start = spek_now();
+            pthread_mutex_lock(&p->mutex);
+            int64_t space;
+            while ((space = reader_tail(p) + p->input_size - head) <= 0 && !p->quit) {
+                pthread_cond_wait(&p->reader_cond, &p->mutex);
+            }
+            pthread_mutex_unlock(&p->mutex);
+            int64_t copy_start = spek_now();
+            p->counters.reader_wait += copy_start - start;
+            if (p->quit) {
+                break;
+            }
 
-        const float *buffer = p->file->get_buffer();
-        while (len-- > 0) {
-            p->input[pos] = *buffer++;
-            pos = (pos + 1) % p->input_size;
+            // Nobody reads this part of the ring until it's handed over in a job.
+            int count = spek_min(space, len - pos);
+            // The block wraps around the end of the ring at most once.
+            int offset = head % p->input_size;
+            int first = spek_min(count, p->input_size - offset);
+            for (int c = 0; c < p->channels; ++c) {
+                const float *src = p->file->get_plane(c) + pos;
+                float *dst = p->input + c * p->input_size;
+                memcpy(dst + offset, src, first * sizeof(float));
+                memcpy(dst, src + first, (count - first) * sizeof(float));
+            }
+            pos += count;
+            head += count;
 
-            // Wake up the worker if we have enough data.
-            if ((pos > prev_pos ? pos : pos + p->input_size) - prev_pos == p->nfft * NFFT) {
-                reader_sync(p, prev_pos = pos);
+            start = spek_now();
+            p->counters.copy += start - copy_start;
+            pthread_mutex_lock(&p->mutex);
+            // Skimming can't read ahead, it doesn't know where to go next until the window is issued.
+            while (reader_schedule(p, head) && p->sparse && !p->quit) {
+                pthread_cond_wait(&p->reader_cond, &p->mutex);
             }
+            pthread_mutex_unlock(&p->mutex);
+            p->counters.reader_wait += spek_now() - start;
         }
-        assert(len == -1);
     }
 
-    if (pos != prev_pos) {
-        // Process the remaining data.
-        reader_sync(p, pos);
+    p->reading = false;
+
+    // Issue what's left as the workers make room, then let them drain the queue and quit.
+    int64_t start = spek_now();
+    pthread_mutex_lock(&p->mutex);
+    while (!p->quit && reader_schedule(p, head)) {
+        pthread_cond_wait(&p->reader_cond, &p->mutex);
     }
+    p->finished = true;
+    pthread_cond_broadcast(&p->worker_cond);
+    pthread_mutex_unlock(&p->mutex);
+    p->counters.reader_wait += spek_now() - start;
 
-    // Force the worker to quit.
-    reader_sync(p, -1);
-    pthread_join(p->worker_thread, NULL);
+    for (auto& worker : p->workers) {
+        if (worker.has_thread) {
+            pthread_join(worker.thread, NULL);
+            worker.has_thread = false;
+        }
+    }
 
     // Notify the client.
-    p->cb(p->fft->get_output_size(), -1, NULL, p->cb_data);
+    p->end_time = spek_now();
+    p->cb(p->bands, -1, -1, NULL, p->cb_data);
     return NULL;
 }
 
-static void reader_sync(struct spek_pipeline *p, int pos)
+// The window is computed once per pipeline, malloc() alignment is enough for 128-bit vectors
+// and the AVX path uses unaligned loads.
+static float * create_window(enum window_function f, int n)
 {
-    pthread_mutex_lock(&p->reader_mutex);
-    while (!p->worker_done) {
-        pthread_cond_wait(&p->reader_cond, &p->reader_mutex);
+    float *window = (float*)malloc(n * sizeof(float));
+    float cf = 2.0f * (float)M_PI / (n - 1.0f);
+    for (int i = 0; i < n; ++i) {
+        switch (f) {
+        case WINDOW_HANN:
+            window[i] = 0.5f * (1.0f - cosf(cf * i));
+            break;
+        case WINDOW_HAMMING:
+            window[i] = 0.53836f - 0.46164f * cosf(cf * i);
+            break;
+        case WINDOW_BLACKMAN_HARRIS:
+            window[i] = 0.35875f - 0.48829f * cosf(cf * i) + 0.14128f * cosf(2 * cf * i)
+                - 0.01168f * cosf(3 * cf * i);
+            break;
+        default:
+            assert(false);
+            window[i] = 0.0f;
+        }
     }
-    p->worker_done = false;
-    pthread_mutex_unlock(&p->reader_mutex);
-
-    pthread_mutex_lock(&p->worker_mutex);
-    p->input_pos = pos;
-    pthread_cond_signal(&p->worker_cond);
-    pthread_mutex_unlock(&p->worker_mutex);
+    return window;
 }
 
-static float get_window(enum window_function f, int i, float *coss, int n) {
-    switch (f) {
-    case WINDOW_HANN:
-        return 0.5f * (1.0f - coss[i]);
-    case WINDOW_HAMMING:
-        return 0.53836f - 0.46164f * coss[i];
-    case WINDOW_BLACKMAN_HARRIS:
-        return 0.35875f - 0.48829f * coss[i] + 0.14128f * coss[2*i % n] - 0.01168f * coss[3*i % n];
-    default:
-        assert(false);
-        return 0.0f;
+// out[i] = in[i] * window[i]
+static void apply_window(float *out, const float *in, const float *window, int n)
+{
+    int i = 0;
+#if defined(__AVX__)
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), _mm256_loadu_ps(window + i)));
+    }
+#elif defined(__SSE__)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(window + i)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(out + i, vmulq_f32(vld1q_f32(in + i), vld1q_f32(window + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = in[i] * window[i];
     }
 }
 
-static void * worker_func(void *pp)
+// Accumulators hold `bands` values per channel for each spectrum delivered, one spectrum after
+// another. Returns NULL if `spectrum` is not delivered.
+static float * spectrum_values(const struct spek_pipeline *p, float *values, int spectrum)
 {
-    struct spek_pipeline *p = (spek_pipeline*)pp;
+    if (p->spectra[spectrum] < 0) {
+        return NULL;
+    }
+    return values + (size_t)p->spectra[spectrum] * p->bands * p->channels;
+}
 
-    int sample = 0;
-    int64_t frames = 0;
-    int64_t num_fft = 0;
-    int64_t acc_error = 0;
-    int head = 0, tail = 0;
-    int prev_head = 0;
+// Nothing was accumulated yet.
+static void clear_spectra(const struct spek_pipeline *p, float *values)
+{
+    int size = p->bands * p->channels;
+    memset(values, 0, size * p->num_spectra * sizeof(float));
+    if (float *min = spectrum_values(p, values, SPECTRUM_MIN)) {
+        for (int i = 0; i < size; i++) {
+            min[i] = INFINITY;
+        }
+    }
+}
 
-    memset(p->output, 0, sizeof(float) * p->fft->get_output_size());
+// Fold the power of one FFT into each spectrum in the same loop, the ones that aren't delivered
+// are compiled out.
+template<bool mean, bool max, bool min>
+static void accumulate_bands(float *sum, float *high, float *low, const float *power, int n)
+{
+    for (int i = 0; i < n; i++) {
+        float value = power[i];
+        if (mean) {
+            sum[i] += value;
+        }
+        if (max) {
+            high[i] = high[i] > value ? high[i] : value;
+        }
+        if (min) {
+            low[i] = low[i] < value ? low[i] : value;
+        }
+    }
+}
 
-    while (true) {
-        pthread_mutex_lock(&p->reader_mutex);
-        p->worker_done = true;
-        pthread_cond_signal(&p->reader_cond);
-        pthread_mutex_unlock(&p->reader_mutex);
+// `offset` is where the bands of the channel start in each spectrum of `values`.
+static void accumulate(const struct spek_pipeline *p, float *values, int offset, const float *power)
+{
+    float *sum = spectrum_values(p, values, SPECTRUM_MEAN);
+    float *high = spectrum_values(p, values, SPECTRUM_MAX);
+    float *low = spectrum_values(p, values, SPECTRUM_MIN);
+    sum = sum ? sum + offset : NULL;
+    high = high ? high + offset : NULL;
+    low = low ? low + offset : NULL;
+    // Indexed by the bits of spek_pipeline_set_spectra().
+    static void (*const accumulators[])(float *, float *, float *, const float *, int) = {
+        NULL,
+        accumulate_bands<true, false, false>,
+        accumulate_bands<false, true, false>,
+        accumulate_bands<true, true, false>,
+        accumulate_bands<false, false, true>,
+        accumulate_bands<true, false, true>,
+        accumulate_bands<false, true, true>,
+        accumulate_bands<true, true, true>,
+    };
+    accumulators[p->spectra_bits](sum, high, low, power, p->bands);
+}
 
-        pthread_mutex_lock(&p->worker_mutex);
-        while (tail == p->input_pos) {
-            pthread_cond_wait(&p->worker_cond, &p->worker_mutex);
+// Add what a job accumulated to its column.
+static void merge_spectra(const struct spek_pipeline *p, float *values, float *job_values)
+{
+    int size = p->bands * p->channels;
+    for (int s = 0; s < SPECTRUM_COUNT; ++s) {
+        float *out = spectrum_values(p, values, s);
+        const float *in = spectrum_values(p, job_values, s);
+        if (!out) {
+            continue;
         }
-        tail = p->input_pos;
-        pthread_mutex_unlock(&p->worker_mutex);
-
-        if (tail == -1) {
-            return NULL;
+        for (int i = 0; i < size; i++) {
+            if (s == SPECTRUM_MEAN) {
+                out[i] += in[i];
+            } else if (s == SPECTRUM_MAX) {
+                out[i] = out[i] > in[i] ? out[i] : in[i];
+            } else {
+                out[i] = out[i] < in[i] ? out[i] : in[i];
+            }
         }
+    }
+}
 
-        while (true) {
-            head = (head + 1) % p->input_size;
-            if (head == tail) {
-                head = prev_head;
-                break;
-            }
-            frames++;
-
-            // If we have enough frames for an FFT or we have
-            // all frames required for the interval run and FFT.
-            bool int_full =
-                acc_error < p->file->get_error_base() &&
-                frames == p->file->get_frames_per_interval();
-            bool int_over =
-                acc_error >= p->file->get_error_base() &&
-                frames == 1 + p->file->get_frames_per_interval();
-
-            if (frames % p->nfft == 0 || ((int_full || int_over) && num_fft == 0)) {
-                prev_head = head;
-                for (int i = 0; i < p->nfft; i++) {
-                    float val = p->input[(p->input_size + head - p->nfft + i) % p->input_size];
-                    val *= get_window(p->window_function, i, p->coss, p->nfft);
-                    p->fft->set_input(i, val);
-                }
-                p->fft->execute();
-                num_fft++;
-                for (int i = 0; i < p->fft->get_output_size(); i++) {
-                    p->output[i] += p->fft->get_output(i);
-                }
-            }
+// Accumulate the power of all FFTs of the job in the worker's output.
+static void worker_run(struct spek_worker *w, const struct spek_job *job)
+{
+    struct spek_pipeline *p = w->p;
+    int batch = w->fft->get_batch();
 
-            // Do we have the FFTs for one interval?
-            if (int_full || int_over) {
-                if (int_over) {
-                    acc_error -= p->file->get_error_base();
-                } else {
-                    acc_error += p->file->get_error_per_interval();
-                }
+    clear_spectra(p, w->output);
+    // Every channel of a window in turn, a batch of them at a time.
+    int total = job->count * p->channels;
+    int ffts = 0;
+    int failed_ffts = 0;
+    int64_t window_time = 0;
+    int64_t fft_time = 0;
+    int64_t start = spek_now();
+    for (int t = 0; t < total && !p->quit; t += batch) {
+        int count = spek_min(batch, total - t);
+        for (int k = 0; k < count; ++k) {
+            // The window covers `nfft` frames before `end`, split in two spans if it wraps
+            // around the end of the ring. Frames before the start of the stream are zeros.
+            // Overlapping windows read the same frames of the ring, nothing is copied.
+            int64_t end = job->end + (int64_t)((t + k) / p->channels) * p->hop;
+            int start = (p->input_size + end - p->nfft) % p->input_size;
+            int first = spek_min(p->nfft, p->input_size - start);
+            const float *input = p->input + ((t + k) % p->channels) * p->input_size;
+            float *fft_input = w->fft->get_window_input(k);
+            apply_window(fft_input, input + start, p->window, first);
+            apply_window(fft_input + first, input, p->window + first, p->nfft - first);
+        }
+        int64_t windowed = spek_now();
+        w->fft->execute_many(count);
+        int64_t end = spek_now();
+        window_time += windowed - start;
+        fft_time += end - windowed;
+        start = end;
+        ffts += count;
+        failed_ffts += w->fft->is_broken() ? count : 0;
+        for (int k = 0; k < count; ++k) {
+            accumulate(p, w->output, ((t + k) % p->channels) * p->bands, w->fft->get_window_output(k));
+        }
+    }
+    // Accumulating the output is counted with the windows of the next batch.
+    p->counters.ffts += ffts;
+    p->counters.failed_ffts += failed_ffts;
+    p->counters.window += window_time + (spek_now() - start);
+    p->counters.fft += fft_time;
+}
 
-                for (int i = 0; i < p->fft->get_output_size(); i++) {
-                    p->output[i] /= num_fft;
-                }
+static void * worker_func(void *pp)
+{
+    struct spek_worker *w = (spek_worker*)pp;
+    struct spek_pipeline *p = w->p;
+
+    pthread_mutex_lock(&p->mutex);
+    while (true) {
+        int64_t start = spek_now();
+        while (p->jobs_taken == p->jobs_issued && !p->finished && !p->quit) {
+            pthread_cond_wait(&p->worker_cond, &p->mutex);
+        }
+        p->counters.worker_wait += spek_now() - start;
+        if (p->quit || p->jobs_taken == p->jobs_issued) {
+            break;
+        }
+        struct spek_job *job = &p->jobs[p->jobs_taken++ % p->num_jobs];
+        pthread_mutex_unlock(&p->mutex);
 
-                p->cb(p->fft->get_output_size(), sample++, p->output, p->cb_data);
+        worker_run(w, job);
 
-                memset(p->output, 0, sizeof(float) * p->fft->get_output_size());
-                frames = 0;
-                num_fft = 0;
+        pthread_mutex_lock(&p->mutex);
+        struct spek_column *column = &p->columns[job->column % (p->num_jobs + 1)];
+        merge_spectra(p, column->output, w->output);
+        column->num_fft += job->count;
+        column->pending--;
+        if (column->closed && !column->pending && !p->quit) {
+            // Nobody else touches a closed column, deliver it without holding the lock.
+            // Jobs cut short by spek_pipeline_cancel() leave it incomplete, it's dropped then.
+            pthread_mutex_unlock(&p->mutex);
+            start = spek_now();
+            int bands = p->band_map ? p->band_map->get_rows() : p->bands;
+            for (int c = 0; c < p->channels; ++c) {
+                for (int s = 0; s < SPECTRUM_COUNT; ++s) {
+                    float *input = spectrum_values(p, column->output, s);
+                    if (!input) {
+                        continue;
+                    }
+                    input += c * p->bands;
+                    float *output = w->values.data() + p->spectra[s] * bands;
+                    if (p->band_map) {
+                        // The map is linear, folding the average is the same as folding every FFT.
+                        // A row of the other spectra holds the average peak or floor of its bands.
+                        p->band_map->apply(output, input);
+                        input = output;
+                    }
+                    float scale = s == SPECTRUM_MEAN ? 1.0f / column->num_fft : 1.0f;
+                    spek_fft_power_to_db(output, input, bands, scale);
+                }
+                int channel = p->channel == AUDIO_ALL_CHANNELS ? c : p->channel;
+                p->cb(bands, channel, job->column, w->values.data(), p->cb_data);
             }
+            clear_spectra(p, column->output);
+            column->num_fft = 0;
+            column->closed = false;
+            p->counters.columns++;
+            p->counters.deliver += spek_now() - start;
+            pthread_mutex_lock(&p->mutex);
         }
+
+        // The column slot must be free before the job is, see reader_tail().
+        job->done = true;
+        while (p->jobs_done < p->jobs_issued && p->jobs[p->jobs_done % p->num_jobs].done) {
+            p->jobs_done++;
+        }
+        p->counters.queue = p->jobs_issued - p->jobs_done;
+        pthread_cond_signal(&p->reader_cond);
     }
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
 }
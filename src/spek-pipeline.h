@@ -1,10 +1,13 @@
 #pragma once
 
+#include <stdint.h>
+
 #include <memory>
 #include <string>
 
 class AudioFile;
-class FFTPlan;
+class BandMap;
+class FFT;
 struct spek_pipeline;
 
 enum window_function {
@@ -15,24 +18,112 @@ enum window_function {
     WINDOW_DEFAULT = WINDOW_HANN,
 };
 
-typedef void (*spek_pipeline_cb)(int bands, int sample, float *values, void *cb_data);
+enum
+{
+    OVERLAP_AUTO = -1,
+    MAX_OVERLAP = 75, // Percent of the window.
+};
+
+// What a column shows of the FFTs that went into it, for each band.
+enum spectrum_type {
+    SPECTRUM_MEAN, // The average power.
+    SPECTRUM_MAX, // Peak hold, brief transients stand out.
+    SPECTRUM_MIN, // The floor below everything that comes and goes.
+    SPECTRUM_COUNT,
+};
+
+// Columns are delivered from the worker threads, possibly several at once and in any order.
+// `values` holds `bands` values of each spectrum chosen by spek_pipeline_set_spectra(), one after
+// another in the order of spectrum_type. The final call with `sample == -1` comes after all the others.
+typedef void (*spek_pipeline_cb)(int bands, int channel, int sample, float *values, void *cb_data);
 
+// Runs `threads` workers, each with its own `fft` plan, or one per core if `threads` is 0.
+// With `channel` set to AUDIO_ALL_CHANNELS all channels are decoded in one pass.
+// The windows of a column overlap by `overlap` percent, up to MAX_OVERLAP, more FFTs are
+// averaged for the same columns. OVERLAP_AUTO only overlaps as much as short columns need.
+// The file is cut into `samples` columns, only columns [first, last) are analysed and
+// the file is read from just before `first`.
 struct spek_pipeline * spek_pipeline_open(
     std::unique_ptr<AudioFile> file,
-    std::unique_ptr<FFTPlan> fft,
+    FFT *fft,
+    int fft_bits,
+    int threads,
     int stream,
     int channel,
     enum window_function window_function,
+    int overlap,
     int samples,
+    int first,
+    int last,
     spek_pipeline_cb cb,
     void *cb_data
 );
 
+// Live input cut into columns of `latency` milliseconds. Each column is delivered as soon as
+// its last frame is read, with the FFT of the `nfft` frames before it or the average of all
+// windows that fit, and the pipeline runs until it's closed. Column numbers keep growing.
+struct spek_pipeline * spek_pipeline_open_live(
+    std::unique_ptr<AudioFile> file,
+    FFT *fft,
+    int fft_bits,
+    int threads,
+    int channel,
+    enum window_function window_function,
+    int overlap,
+    int latency,
+    spek_pipeline_cb cb,
+    void *cb_data
+);
+
+// Deliver the rows of `band_map` instead of the bands of each column, before the pipeline starts.
+void spek_pipeline_set_band_map(struct spek_pipeline *pipeline, std::shared_ptr<const BandMap> band_map);
+// Skim the file for a quick preview, before the pipeline starts: a single FFT from the middle
+// of each column, the rest of it is seeked over instead of decoded.
+void spek_pipeline_set_sparse(struct spek_pipeline *pipeline, bool sparse);
+// Deliver these spectra of each column, a bit for each spectrum_type, before the pipeline starts.
+// They are all accumulated in the same pass over the FFTs, only the mean by default.
+void spek_pipeline_set_spectra(struct spek_pipeline *pipeline, unsigned spectra);
 void spek_pipeline_start(struct spek_pipeline *pipeline);
-void spek_pipeline_close(struct spek_pipeline *pipeline);
+// Stop as soon as possible without waiting for it, from any thread: decoding is interrupted and
+// workers drop their jobs. Columns that were almost done may still be delivered afterwards,
+// until the pipeline is closed.
+void spek_pipeline_cancel(struct spek_pipeline *pipeline);
+// Cancels the pipeline and waits for its threads. Returns the file, AudioFile::rewind() it to
+// open the next pipeline without opening it again.
+std::unique_ptr<AudioFile> spek_pipeline_close(struct spek_pipeline *pipeline);
 
-std::string spek_pipeline_desc(const struct spek_pipeline *pipeline);
+std::string spek_pipeline_desc(const struct spek_pipeline *pipeline, int channel);
+// The same without what the pipeline adds, e.g. for the error of a file that can't be analysed.
+std::string spek_file_desc(const AudioFile& file, int stream, int channel);
 int spek_pipeline_streams(const struct spek_pipeline *pipeline);
 int spek_pipeline_channels(const struct spek_pipeline *pipeline);
 double spek_pipeline_duration(const struct spek_pipeline *pipeline);
 int spek_pipeline_sample_rate(const struct spek_pipeline *pipeline);
+
+// What a pipeline did since it was started and where the time went, summed over all of its
+// threads and segments. Times are in seconds, waits are spent blocked on a condition variable.
+struct spek_pipeline_stats
+{
+    int64_t frames; // Decoded, per channel.
+    int64_t ffts;
+    int64_t failed_ffts; // Of those, the ones the builtin DFT did after the backend failed.
+    int64_t columns; // Delivered.
+    double elapsed; // Until the last column, or now if it's still running.
+    double demux; // See AudioTimes.
+    double decode;
+    double convert;
+    double copy; // Decoded frames into the input ring.
+    double window;
+    double fft;
+    double deliver; // Band map, dB values and the callback.
+    double reader_wait; // For room in the input ring or the job queue.
+    double worker_wait; // For jobs.
+    int queue; // Jobs issued but not finished yet.
+    int max_queue;
+    int threads; // Workers.
+};
+
+// Safe to call from any thread while the pipeline is open, the counters are updated as it goes.
+struct spek_pipeline_stats spek_pipeline_get_stats(const struct spek_pipeline *pipeline);
+// One line for logs, groups of numbers separated by "; ".
+std::string spek_pipeline_format_stats(const struct spek_pipeline_stats& stats);
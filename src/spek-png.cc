@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "spek-png.h"
+
+enum
+{
+    CHUNK_SIZE = 64 * 1024,
+    FILTER_SUB = 1,
+};
+
+struct CrcTable
+{
+    uint32_t values[256];
+
+    CrcTable()
+    {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            this->values[i] = c;
+        }
+    }
+};
+
+static uint32_t png_crc(uint32_t crc, const unsigned char *data, size_t size)
+{
+    // Built once, even with several images being written at the same time.
+    static const CrcTable table;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_uint32(unsigned char *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+PngChunkStream::PngChunkStream(wxOutputStream& file) : file(file)
+{
+}
+
+bool PngChunkStream::write_chunk(const char *type, const unsigned char *data, size_t size)
+{
+    unsigned char header[8];
+    put_uint32(header, size);
+    memcpy(header + 4, type, 4);
+    unsigned char footer[4];
+    put_uint32(footer, png_crc(png_crc(0, header + 4, 4), data, size));
+    this->file.Write(header, sizeof(header));
+    if (size) {
+        this->file.Write(data, size);
+    }
+    this->file.Write(footer, sizeof(footer));
+    return this->file.IsOk();
+}
+
+bool PngChunkStream::flush_chunk()
+{
+    bool ok = this->data.empty() || write_chunk("IDAT", this->data.data(), this->data.size());
+    this->data.clear();
+    return ok;
+}
+
+size_t PngChunkStream::OnSysWrite(const void *buffer, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)buffer;
+    this->data.insert(this->data.end(), bytes, bytes + size);
+    if (this->data.size() >= CHUNK_SIZE && !flush_chunk()) {
+        m_lasterror = wxSTREAM_WRITE_ERROR;
+        return 0;
+    }
+    return size;
+}
+
+PngWriter::PngWriter(const wxString& path, int width, int height) :
+    width(width), height(height), rows(0), file(path), chunks(file), zlib(chunks, -1, wxZLIB_ZLIB),
+    row(1 + width * 3)
+{
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    this->file.Write(signature, sizeof(signature));
+    unsigned char header[13];
+    put_uint32(header, width);
+    put_uint32(header + 4, height);
+    header[8] = 8; // Bits per channel.
+    header[9] = 2; // RGB.
+    header[10] = 0; // Deflate.
+    header[11] = 0; // Adaptive filtering.
+    header[12] = 0; // Not interlaced.
+    this->chunks.write_chunk("IHDR", header, sizeof(header));
+}
+
+bool PngWriter::write_row(const unsigned char *rgb)
+{
+    // Differences to the pixel on the left compress much better on smooth spectrograms.
+    unsigned char *out = this->row.data();
+    out[0] = FILTER_SUB;
+    memcpy(out + 1, rgb, 3);
+    for (int i = 3; i < this->width * 3; ++i) {
+        out[1 + i] = rgb[i] - rgb[i - 3];
+    }
+    this->zlib.Write(out, this->row.size());
+    this->rows++;
+    return this->zlib.IsOk();
+}
+
+bool PngWriter::finish()
+{
+    if (!this->file.IsOk() || this->rows != this->height || !this->zlib.Close() ||
+        !this->chunks.flush_chunk()) {
+        return false;
+    }
+    return this->chunks.write_chunk("IEND", NULL, 0) && this->file.Close();
+}
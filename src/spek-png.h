@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include <wx/string.h>
+#include <wx/wfstream.h>
+#include <wx/zstream.h>
+
+// Collects the compressed image data and writes it to the file in IDAT chunks.
+class PngChunkStream : public wxOutputStream
+{
+public:
+    PngChunkStream(wxOutputStream& file);
+
+    bool write_chunk(const char *type, const unsigned char *data, size_t size);
+    bool flush_chunk();
+
+protected:
+    size_t OnSysWrite(const void *buffer, size_t size) override;
+
+private:
+    wxOutputStream& file;
+    std::vector<unsigned char> data;
+};
+
+// Writes an 8-bit RGB PNG image one row at a time, top row first, so that the image never has to
+// be kept in memory as a whole.
+class PngWriter
+{
+public:
+    PngWriter(const wxString& path, int width, int height);
+
+    // `width` RGB pixels.
+    bool write_row(const unsigned char *rgb);
+    // Call after all rows are written, returns false if anything failed.
+    bool finish();
+
+private:
+    int width;
+    int height;
+    int rows;
+    wxFileOutputStream file;
+    PngChunkStream chunks;
+    wxZlibOutputStream zlib;
+    std::vector<unsigned char> row;
+};
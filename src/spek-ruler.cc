@@ -48,9 +48,7 @@ void SpekRuler::draw_tick(wxDC& dc, int tick)
     double TICK_LEN = 4;
 
     wxString label = this->formatter(tick);
-    int value = this->pos == TOP || this->pos == BOTTOM ?
-        tick : this->max_units + this->min_units - tick;
-    double p = this->offset + this->scale * (value - min_units);
+    double p = this->tick_offset(tick);
     wxSize size = dc.GetTextExtent(label);
     int w = size.GetWidth();
     int h = size.GetHeight();
@@ -75,3 +73,50 @@ void SpekRuler::draw_tick(wxDC& dc, int tick)
         dc.DrawLine(this->x, this->y + p, this->x - TICK_LEN, this->y + p);
     }
 }
+
+double SpekRuler::tick_offset(int tick)
+{
+    int value = this->pos == TOP || this->pos == BOTTOM ?
+        tick : this->max_units + this->min_units - tick;
+    return this->offset + this->scale * (value - min_units);
+}
+
+SpekScaleRuler::SpekScaleRuler(
+    int x, int y, Position pos, wxString sample_label,
+    int *ticks, int min_units, int max_units, double spacing,
+    double length, std::function<double (int unit)> position, formatter_cb formatter)
+    :
+    SpekRuler(x, y, pos, sample_label, ticks, min_units, max_units, spacing, 0.0, 0.0, formatter),
+    length(length), position(position)
+{
+}
+
+void SpekScaleRuler::draw(wxDC& dc)
+{
+    wxSize size = dc.GetTextExtent(sample_label);
+    int len = this->pos == TOP || this->pos == BOTTOM ? size.GetWidth() : size.GetHeight();
+
+    this->draw_tick(dc, min_units);
+    this->draw_tick(dc, max_units);
+
+    // Going up, each tick needs some space after the last one and before the end.
+    double last = 0.0;
+    for (int i = 0; factors[i]; ++i) {
+        int tick = factors[i];
+        if (tick <= min_units || tick >= max_units) {
+            continue;
+        }
+        double p = this->length * this->position(tick);
+        if (p - last >= this->spacing * len && this->length - p >= len * 1.2) {
+            this->draw_tick(dc, tick);
+            last = p;
+        }
+    }
+}
+
+// Vertical rulers start at the top, with the highest unit.
+double SpekScaleRuler::tick_offset(int tick)
+{
+    double p = this->length * this->position(tick);
+    return this->pos == TOP || this->pos == BOTTOM ? p : this->length - p;
+}
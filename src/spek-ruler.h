@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include <wx/dc.h>
 #include <wx/string.h>
 
@@ -21,11 +23,14 @@ public:
         int *factors, int min_units, int max_units, double spacing,
         double scale, double offset, formatter_cb formatter
     );
+    virtual ~SpekRuler() {}
 
-    void draw(wxDC& dc);
+    virtual void draw(wxDC& dc);
 
 protected:
     void draw_tick(wxDC& dc, int tick);
+    // Offset of `tick` from the start of the ruler.
+    virtual double tick_offset(int tick);
 
     int x;
     int y;
@@ -39,3 +44,24 @@ protected:
     double offset;
     formatter_cb formatter;
 };
+
+// A ruler for units that aren't spread evenly over it, e.g. frequencies on a log scale. Only
+// the zero terminated `ticks` that don't crowd each other are drawn, `position` maps units to
+// [0, 1] of its `length`.
+class SpekScaleRuler : public SpekRuler
+{
+public:
+    SpekScaleRuler(
+        int x, int y, Position pos, wxString sample_label,
+        int *ticks, int min_units, int max_units, double spacing,
+        double length, std::function<double (int unit)> position, formatter_cb formatter
+    );
+
+    void draw(wxDC& dc) override;
+
+protected:
+    double tick_offset(int tick) override;
+
+    double length;
+    std::function<double (int unit)> position;
+};
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "spek-utils.h"
+
+#include "spek-scale.h"
+
+enum
+{
+    MAX_CACHED_MAPS = 16,
+};
+
+static double min_log_freq(double max_freq)
+{
+    return std::min((double)MIN_LOG_FREQ, max_freq / 2);
+}
+
+static double mel(double freq)
+{
+    return 2595.0 * log10(1.0 + freq / 700.0);
+}
+
+double spek_scale_position(enum frequency_scale scale, double freq, double max_freq)
+{
+    switch (scale) {
+    case SCALE_LOG: {
+        double min_freq = min_log_freq(max_freq);
+        return freq <= min_freq ? 0.0 : log(freq / min_freq) / log(max_freq / min_freq);
+    }
+    case SCALE_MEL:
+        return mel(freq) / mel(max_freq);
+    default:
+        return freq / max_freq;
+    }
+}
+
+double spek_scale_freq(enum frequency_scale scale, double position, double max_freq)
+{
+    switch (scale) {
+    case SCALE_LOG: {
+        double min_freq = min_log_freq(max_freq);
+        return min_freq * pow(max_freq / min_freq, position);
+    }
+    case SCALE_MEL:
+        return 700.0 * (pow(10.0, position * mel(max_freq) / 2595.0) - 1.0);
+    default:
+        return position * max_freq;
+    }
+}
+
+BandMap::BandMap(enum frequency_scale scale, int bands, int sample_rate, int rows) :
+    bands(bands), rows(rows)
+{
+    // Band i is centred on i * step Hz and covers half a step on either side.
+    double max_freq = sample_rate / 2.0;
+    double step = max_freq / (bands - 1);
+    for (int row = 0; row < rows; ++row) {
+        this->starts.push_back(this->weights.size());
+        double from = spek_scale_freq(scale, row / (double)rows, max_freq) / step;
+        double to = spek_scale_freq(scale, (row + 1) / (double)rows, max_freq) / step;
+        to = std::min(to, bands - 1.0);
+        if (to - from >= 1.0) {
+            int first = (int)floor(from + 0.5);
+            int last = spek_min((int)floor(to + 0.5), bands - 1);
+            for (int i = first; i <= last; ++i) {
+                double overlap = std::min(to, i + 0.5) - std::max(from, i - 0.5);
+                if (overlap > 0.0) {
+                    this->add(i, overlap / (to - from));
+                }
+            }
+        } else {
+            double centre = std::min((from + to) / 2, bands - 1.0);
+            int i = spek_min((int)centre, bands - 2);
+            double t = centre - i;
+            this->add(i, 1.0 - t);
+            this->add(i + 1, t);
+        }
+    }
+    this->starts.push_back(this->weights.size());
+}
+
+std::shared_ptr<const BandMap> BandMap::get(enum frequency_scale scale, int bands, int sample_rate, int rows)
+{
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, int, int>, std::shared_ptr<const BandMap>> maps;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_tuple((int)scale, bands, sample_rate, rows);
+    auto& map = maps[key];
+    if (!map) {
+        if (maps.size() > MAX_CACHED_MAPS) {
+            // Whoever is still using them keeps their own reference.
+            maps.clear();
+            return maps[key] = std::make_shared<const BandMap>(scale, bands, sample_rate, rows);
+        }
+        map = std::make_shared<const BandMap>(scale, bands, sample_rate, rows);
+    }
+    return map;
+}
+
+void BandMap::apply(float *out, const float *in) const
+{
+    const int *indices = this->indices.data();
+    const float *weights = this->weights.data();
+    for (int row = 0; row < this->rows; ++row) {
+        float sum = 0.0f;
+        for (int i = this->starts[row]; i < this->starts[row + 1]; ++i) {
+            sum += in[indices[i]] * weights[i];
+        }
+        out[row] = sum;
+    }
+}
+
+void BandMap::add(int band, float weight)
+{
+    this->indices.push_back(band);
+    this->weights.push_back(weight);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+enum frequency_scale {
+    SCALE_LINEAR,
+    SCALE_LOG,
+    SCALE_MEL,
+    SCALE_COUNT,
+    SCALE_DEFAULT = SCALE_LINEAR,
+};
+
+enum
+{
+    MIN_LOG_FREQ = 20, // Hz at the bottom of the log scale.
+};
+
+// Where `freq` is on `scale`, from 0 at the bottom to 1 at `max_freq`, and the other way round.
+double spek_scale_position(enum frequency_scale scale, double freq, double max_freq);
+double spek_scale_freq(enum frequency_scale scale, double position, double max_freq);
+
+// FFT bands folded into `rows` rows spread evenly over `scale`, a sparse matrix with a few
+// neighbouring bands in each row: their average where the row spans several bands, the two
+// nearest interpolated where it's narrower than one. It's linear, apply it to power values.
+class BandMap
+{
+public:
+    BandMap(enum frequency_scale scale, int bands, int sample_rate, int rows);
+
+    // Built once for each set of arguments and shared by all users.
+    static std::shared_ptr<const BandMap> get(
+        enum frequency_scale scale, int bands, int sample_rate, int rows
+    );
+
+    int get_bands() const { return this->bands; }
+    int get_rows() const { return this->rows; }
+    // `rows` values from `bands` ones, the lowest frequency first.
+    void apply(float *out, const float *in) const;
+
+private:
+    void add(int band, float weight);
+
+    int bands;
+    int rows;
+    std::vector<int> starts; // Index of the first weight of each row, and the end.
+    std::vector<int> indices; // Band of each weight.
+    std::vector<float> weights;
+};
@@ -0,0 +1,165 @@
+#include <math.h>
+#include <string.h>
+
+#include "spek-sink.h"
+
+ColumnFile::ColumnFile(FILE *file, int size, int offset) :
+    file(file), size(size), offset(offset), ok(file != NULL)
+{
+}
+
+ColumnFile::~ColumnFile()
+{
+    if (this->file) {
+        fclose(this->file);
+    }
+}
+
+bool ColumnFile::write(int64_t record, const void *data)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ok = this->ok && this->seek(this->offset + record * this->size) &&
+        fwrite(data, this->size, 1, this->file) == 1;
+    return this->ok;
+}
+
+bool ColumnFile::write_prefix(const void *data)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ok = this->ok && this->seek(0) && fwrite(data, this->offset, 1, this->file) == 1;
+    return this->ok;
+}
+
+bool ColumnFile::read(int64_t record, int offset, int count, void *data)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ok = this->ok && this->seek(this->offset + record * this->size + offset) &&
+        fread(data, count, 1, this->file) == 1;
+    return this->ok;
+}
+
+bool ColumnFile::is_ok()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ok = this->ok && !fflush(this->file);
+    return this->ok;
+}
+
+// Files get much bigger than 2 GB.
+bool ColumnFile::seek(int64_t position)
+{
+#ifdef _WIN32
+    return !_fseeki64(this->file, position, SEEK_SET);
+#else
+    return !fseeko(this->file, position, SEEK_SET);
+#endif
+}
+
+// Rounded to the nearest, ties to even.
+static uint16_t float_to_half(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000;
+    int exponent = (int)((f >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = f & 0x7FFFFF;
+    if (((f >> 23) & 0xFF) == 0xFF) {
+        // Infinity or NaN.
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+    }
+    if (exponent >= 31) {
+        return sign | 0x7C00;
+    }
+    uint32_t half, rest, halfway;
+    if (exponent <= 0) {
+        // Subnormal, or zero once it's too small.
+        if (exponent < -10) {
+            return sign;
+        }
+        int shift = 14 - exponent;
+        mantissa |= 0x800000;
+        half = sign | (mantissa >> shift);
+        rest = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        half = sign | (exponent << 10) | (mantissa >> 13);
+        rest = mantissa & 0x1FFF;
+        halfway = 0x1000;
+    }
+    // Carrying into the exponent is still the right value, up to infinity.
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+        half++;
+    }
+    return half;
+}
+
+RawSink::RawSink(FILE *file, int channels, int bands, int first, int columns,
+    enum sink_format format, int offset) :
+    file(file, bands * value_size(format), offset), channels(channels), bands(bands), first(first),
+    columns(columns), format(format)
+{
+}
+
+void RawSink::write(int channel, int column, const float *values)
+{
+    int64_t record = (int64_t)(column - this->first) * this->channels + channel;
+    if (record < 0 || (this->columns && column - this->first >= this->columns)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if ((size_t)record >= this->written.size()) {
+            this->written.resize(record + 1);
+        }
+        this->written[record] = true;
+    }
+    this->write_record(record, values);
+}
+
+void RawSink::write_record(int64_t record, const float *values)
+{
+    if (this->format == SINK_FLOAT16) {
+        std::vector<uint16_t> halves(this->bands);
+        for (int i = 0; i < this->bands; ++i) {
+            halves[i] = float_to_half(values[i]);
+        }
+        this->file.write(record, halves.data());
+    } else {
+        this->file.write(record, values);
+    }
+}
+
+bool RawSink::finish()
+{
+    // Whole columns only, with the holes filled in.
+    std::vector<float> silence(this->bands, -INFINITY);
+    size_t records = this->columns ? (size_t)this->columns * this->channels :
+        (this->written.size() + this->channels - 1) / this->channels * this->channels;
+    for (size_t record = 0; record < records; ++record) {
+        if (record >= this->written.size() || !this->written[record]) {
+            this->write_record(record, silence.data());
+        }
+    }
+    return this->file.is_ok();
+}
+
+NpySink::NpySink(FILE *file, int channels, int bands, int first, int columns, enum sink_format format) :
+    RawSink(file, channels, bands, first, columns, format, header(channels, bands, columns, format).size())
+{
+    this->file.write_prefix(header(channels, bands, columns, format).data());
+}
+
+// Format version 1.0, the header is padded so that the data starts on a 64 byte boundary.
+std::string NpySink::header(int channels, int bands, int columns, enum sink_format format)
+{
+    const uint16_t one = 1;
+    bool little = *(const unsigned char *)&one == 1;
+    std::string dict = std::string("{'descr': '") + (little ? "<" : ">") +
+        (format == SINK_FLOAT16 ? "f2" : "f4") + "', 'fortran_order': False, 'shape': (" +
+        std::to_string(columns) + ", " + std::to_string(channels) + ", " + std::to_string(bands) + "), }";
+    size_t size = (10 + dict.size() + 1 + 63) / 64 * 64;
+    dict.append(size - 10 - dict.size() - 1, ' ');
+    dict += '\n';
+    size_t length = dict.size();
+    return std::string("\x93NUMPY\x01\x00", 8) + (char)(length & 0xFF) + (char)(length >> 8) + dict;
+}
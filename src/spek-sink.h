@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Takes the columns of a pipeline as they are finished, in any order and from any thread, so
+// that nothing has to keep all of them in memory.
+class ColumnSink
+{
+public:
+    virtual ~ColumnSink() {}
+
+    // `bands` dB values of a column, each column and channel is written at most once.
+    virtual void write(int channel, int column, const float *values) = 0;
+    // Call once the pipeline is done, returns false if anything failed to be written.
+    virtual bool finish() = 0;
+};
+
+// Records of `size` bytes in a file, written in any order and read back in parts, e.g. to turn
+// columns into rows of an image. The file is the only place they are kept.
+class ColumnFile
+{
+public:
+    // Takes over `file`, e.g. one from tmpfile(). Records start `offset` bytes into the file.
+    ColumnFile(FILE *file, int size, int offset = 0);
+    ~ColumnFile();
+
+    bool write(int64_t record, const void *data);
+    // The `offset` bytes before the first record.
+    bool write_prefix(const void *data);
+    // Read `count` bytes starting at `offset` of a record.
+    bool read(int64_t record, int offset, int count, void *data);
+    bool is_ok();
+
+private:
+    bool seek(int64_t position);
+
+    std::mutex mutex;
+    FILE *file;
+    int size;
+    int offset;
+    bool ok;
+};
+
+enum sink_format
+{
+    SINK_FLOAT32,
+    SINK_FLOAT16,
+};
+
+// Columns of `channels` channels from `first` on, written to `file` as native float values, all
+// bands of channel 0 of the first column, then channel 1 and so on. Columns that never arrived,
+// e.g. past the end of the stream, are filled with -inf. With `columns` set the file always
+// holds that many, otherwise it ends with the last one that arrived.
+//
+// Each value goes straight to its place in the file, other processes can map it while it's
+// being written.
+class RawSink : public ColumnSink
+{
+public:
+    RawSink(FILE *file, int channels, int bands, int first, int columns = 0,
+        enum sink_format format = SINK_FLOAT32, int offset = 0);
+
+    void write(int channel, int column, const float *values) override;
+    bool finish() override;
+
+protected:
+    static int value_size(enum sink_format format) { return format == SINK_FLOAT16 ? 2 : 4; }
+
+    ColumnFile file;
+
+private:
+    void write_record(int64_t record, const float *values);
+
+    int channels;
+    int bands;
+    int first;
+    int columns;
+    enum sink_format format;
+    std::mutex mutex;
+    std::vector<bool> written; // One per column and channel.
+};
+
+// A NumPy .npy file of `columns` columns from `first` on, shaped (columns, channels, bands).
+class NpySink : public RawSink
+{
+public:
+    NpySink(FILE *file, int channels, int bands, int first, int columns, enum sink_format format);
+
+private:
+    static std::string header(int channels, int bands, int columns, enum sink_format format);
+};
@@ -1,12 +1,20 @@
+#include <algorithm>
 #include <cmath>
+#include <thread>
 
-#include <wx/dcbuffer.h>
+#include <wx/crt.h>
+#include <wx/dcclient.h>
+#include <wx/filename.h>
 
 #include "spek-audio.h"
+#include "spek-cache.h"
 #include "spek-events.h"
 #include "spek-fft.h"
 #include "spek-platform.h"
 #include "spek-ruler.h"
+#include "spek-scale.h"
+#include "spek-sink.h"
+#include "spek-tiles.h"
 #include "spek-utils.h"
 
 #include "spek-spectrogram.h"
@@ -33,11 +41,45 @@ enum
     BPAD = 40,
     GAP = 10,
     RULER = 10,
+    DRAW_TILE = 16, // Columns coloured together before they are copied into the image.
+    MIN_COLUMNS = 1024, // Columns analysed at least, see analysis_columns().
+    MIN_ROWS = 128, // Rows of a log or mel scale at least, see analysis_rows().
+    MAX_LEVELS = 16, // Zoom levels stored, each has twice as many columns as the previous one.
+    MAX_COLUMNS_PER_SECOND = 100, // No need to zoom in any further.
+    PREVIEW_LEVEL = -1, // The pass that skims the file before level 0 is analysed.
+    PREVIEW_STEP = 8, // Columns of level 0 per column of the preview.
+    MIN_PREVIEW_DURATION = 60, // Seconds, shorter files are done before a preview would help.
+    TILE_MEMORY = 256 << 20, // Bytes of tiles kept around, level 0 included.
+    CACHE_SIZE = 256 << 20, // Bytes of finished spectrograms kept on disk.
+    CACHE_BITS = 16,
+    LATENCY = 50,
+    MIN_LATENCY = 5,
+    MAX_LATENCY = 1000,
+};
+
+// What the pipeline threads of a pass need. A stopped pass may still be finishing in the
+// background while the next one runs, so everything it touches is its own.
+struct SpekPass
+{
+    SpekSpectrogram *spectrogram;
+    int generation;
+    std::shared_ptr<TileStore> store; // The preview or the store of all levels.
+    int level; // Of `store`.
+    int64_t first; // Columns [first, last) are kept.
+    int64_t last;
+    bool live;
 };
 
 // Forward declarations.
 static wxString trim(wxDC& dc, const wxString& s, int length, bool trim_end);
 static int bits_to_bands(int bits);
+static int analysis_columns(int width);
+static int analysis_rows(enum frequency_scale scale, int bits, int height);
+static int zoom_levels(int samples, double duration, bool live);
+static int fine_tiles(int samples);
+static int fit_rows(int rows, int channels, int samples, int levels);
+static int next_overlap(int overlap, int step);
+static std::string cache_dir();
 
 SpekSpectrogram::SpekSpectrogram(wxFrame *parent) :
     wxWindow(
@@ -46,24 +88,61 @@ SpekSpectrogram::SpekSpectrogram(wxFrame *parent) :
     ),
     audio(new Audio()), // TODO: refactor
     fft(new FFT()),
+    cache(new SpectrumCache(cache_dir(), CACHE_SIZE)),
     pipeline(NULL),
+    generation(0),
+    closers(0),
+    file_stream(0),
     streams(0),
     stream(0),
     channels(0),
     channel(0),
     window_function(WINDOW_DEFAULT),
+    overlap(OVERLAP_AUTO),
+    latency(LATENCY),
+    descs(1),
     duration(0.0),
     sample_rate(0),
     palette(PALETTE_DEFAULT),
     palette_image(),
-    image(1, 1),
-    prev_width(-1),
+    images(1, wxImage(1, 1)),
     fft_bits(FFT_BITS),
     urange(URANGE),
-    lrange(LRANGE)
+    lrange(LRANGE),
+    scale(SCALE_DEFAULT),
+    wanted_rows(0),
+    rows(0),
+    spectrum(SPECTRUM_MEAN),
+    frame_dirty(true),
+    dirty_first(0),
+    dirty_last(0),
+    view_start(0.0),
+    view_length(1.0),
+    view_level(0),
+    view_first(0),
+    pass_level(0),
+    pass_first(0),
+    pass_last(0),
+    scroll(0),
+    show_stats(false),
+    stats(),
+    event_time(0),
+    paint_time(0)
 {
     this->create_palette();
 
+    this->normal_font = wxFont(
+        (int)round(9 * spek_platform_font_scale()),
+        wxFONTFAMILY_SWISS,
+        wxFONTSTYLE_NORMAL,
+        wxFONTWEIGHT_NORMAL
+    );
+    this->large_font = wxFont(this->normal_font);
+    this->large_font.SetPointSize((int)round(10 * spek_platform_font_scale()));
+    this->large_font.SetWeight(wxFONTWEIGHT_BOLD);
+    this->small_font = wxFont(this->normal_font);
+    this->small_font.SetPointSize((int)round(8 * spek_platform_font_scale()));
+
     SetBackgroundStyle(wxBG_STYLE_CUSTOM);
     SetFocus();
 }
@@ -71,20 +150,61 @@ SpekSpectrogram::SpekSpectrogram(wxFrame *parent) :
 SpekSpectrogram::~SpekSpectrogram()
 {
     this->stop();
+    this->wait_closed();
 }
 
 void SpekSpectrogram::open(const wxString& path, const wxString& device)
 {
+    this->stop();
+    this->file.reset();
     this->path = path;
     this->device = device;
     this->stream = 0;
     this->channel = 0;
+    this->view_start = 0.0;
+    this->view_length = 1.0;
     start();
+    invalidate();
+}
+
+void SpekSpectrogram::set_latency(int latency)
+{
+    this->latency = spek_max(MIN_LATENCY, spek_min(latency, MAX_LATENCY));
+}
+
+void SpekSpectrogram::invalidate()
+{
+    this->frame_dirty = true;
     Refresh();
 }
 
 void SpekSpectrogram::save(const wxString& path)
 {
+    // The values of the overview go out as they are, all channels of the spectrum shown.
+    if (wxFileName(path).GetExt().Lower() == "npy") {
+        if (!this->store) {
+            return;
+        }
+        TileStore *store = this->store.get();
+        int channels = store->get_channels();
+        int columns = store->get_columns(0);
+        NpySink sink(wxFopen(path, "wb"), channels, this->rows, 0, columns, SINK_FLOAT32);
+        {
+            std::lock_guard<std::mutex> lock(store->get_mutex());
+            for (int column = 0; column < columns; ++column) {
+                for (int channel = 0; channel < channels; ++channel) {
+                    if (const float *values = store->get(0, channel, column)) {
+                        sink.write(channel, column, values);
+                    }
+                }
+            }
+        }
+        if (!sink.finish()) {
+            wxLogError(_("Cannot write %s"), path);
+        }
+        return;
+    }
+
     wxSize size = GetClientSize();
     wxBitmap bitmap(size.GetWidth(), size.GetHeight());
     wxMemoryDC dc(bitmap);
@@ -94,37 +214,57 @@ void SpekSpectrogram::save(const wxString& path)
 
 void SpekSpectrogram::on_char(wxKeyEvent& evt)
 {
+    // Palette and range only change the colours, the cached columns are painted again.
+    bool restart = true;
     switch (evt.GetKeyCode()) {
     case 'c':
-        if (this->channels) {
-            this->channel = (this->channel + 1) % this->channels;
-        }
-        break;
     case 'C':
+        // Every channel has already been drawn, just show another one.
         if (this->channels) {
-            this->channel = (this->channel - 1 + this->channels) % this->channels;
+            int step = evt.GetKeyCode() == 'c' ? 1 : this->channels - 1;
+            this->channel = (this->channel + step) % this->channels;
+            invalidate();
         }
-        break;
+        return;
     case 'f':
         this->window_function = (enum window_function) ((this->window_function + 1) % WINDOW_COUNT);
         break;
+    case 'i':
+    case 'I':
+        this->show_stats = !this->show_stats;
+        Refresh(false);
+        return;
     case 'F':
         this->window_function =
             (enum window_function) ((this->window_function - 1 + WINDOW_COUNT) % WINDOW_COUNT);
         break;
+    case 'o':
+    case 'O':
+        this->overlap = next_overlap(this->overlap, evt.GetKeyCode() == 'o' ? 1 : -1);
+        break;
+    case 'm':
+    case 'M':
+        // Only the spectrum shown is kept, another one is analysed again unless it's cached.
+        this->spectrum = (enum spectrum_type)
+            ((this->spectrum + (evt.GetKeyCode() == 'm' ? 1 : SPECTRUM_COUNT - 1)) % SPECTRUM_COUNT);
+        break;
     case 'l':
         this->lrange = spek_min(this->lrange + 1, this->urange - 1);
+        restart = false;
         break;
     case 'L':
         this->lrange = spek_max(this->lrange - 1, MIN_RANGE);
+        restart = false;
         break;
     case 'p':
         this->palette = (enum palette) ((this->palette + 1) % PALETTE_COUNT);
         this->create_palette();
+        restart = false;
         break;
     case 'P':
         this->palette = (enum palette) ((this->palette - 1 + PALETTE_COUNT) % PALETTE_COUNT);
         this->create_palette();
+        restart = false;
         break;
     case 's':
         if (this->streams) {
@@ -138,9 +278,23 @@ void SpekSpectrogram::on_char(wxKeyEvent& evt)
         break;
     case 'u':
         this->urange = spek_min(this->urange + 1, MAX_RANGE);
+        restart = false;
         break;
     case 'U':
         this->urange = spek_max(this->urange - 1, this->lrange + 1);
+        restart = false;
+        break;
+    case 'z':
+    case 'Z':
+    case WXK_LEFT:
+    case WXK_RIGHT:
+        zoom(evt.GetKeyCode());
+        return;
+    case 'y':
+        this->scale = (enum frequency_scale) ((this->scale + 1) % SCALE_COUNT);
+        break;
+    case 'Y':
+        this->scale = (enum frequency_scale) ((this->scale - 1 + SCALE_COUNT) % SCALE_COUNT);
         break;
     case 'w':
         this->fft_bits = spek_min(this->fft_bits + 1, MAX_FFT_BITS);
@@ -155,71 +309,351 @@ void SpekSpectrogram::on_char(wxKeyEvent& evt)
         return;
     }
 
-    start();
-    Refresh();
+    if (restart) {
+        start();
+    } else {
+        recolour();
+    }
+    invalidate();
 }
 
+// The whole window is kept in `frame`, painting only copies the damaged parts over.
 void SpekSpectrogram::on_paint(wxPaintEvent&)
 {
-    wxAutoBufferedPaintDC dc(this);
-    render(dc);
+    wxPaintDC dc(this);
+    wxSize size = GetClientSize();
+    if (size.GetWidth() <= 0 || size.GetHeight() <= 0) {
+        return;
+    }
+    int64_t start = spek_now();
+
+    if (!this->frame.IsOk() || this->frame.GetWidth() != size.GetWidth() ||
+        this->frame.GetHeight() != size.GetHeight()) {
+        this->frame = wxBitmap(size.GetWidth(), size.GetHeight());
+        this->frame_dirty = true;
+    }
+
+    wxMemoryDC frame_dc(this->frame);
+    if (this->frame_dirty) {
+        render(frame_dc);
+        this->frame_dirty = false;
+        this->dirty_first = this->dirty_last = 0;
+    } else if (this->dirty_first < this->dirty_last) {
+        render_columns(frame_dc, this->dirty_first, this->dirty_last);
+        this->dirty_first = this->dirty_last = 0;
+    }
+
+    for (wxRegionIterator it(GetUpdateRegion()); it; ++it) {
+        wxRect rect = it.GetRect();
+        dc.Blit(rect.x, rect.y, rect.width, rect.height, &frame_dc, rect.x, rect.y);
+    }
+    this->paint_time += spek_now() - start;
+
+    // Not part of `frame`, saved images don't have it.
+    if (this->show_stats) {
+        draw_stats(dc);
+    }
+}
+
+// One line per group of numbers, from the running pipeline or the last one.
+void SpekSpectrogram::draw_stats(wxDC& dc)
+{
+    struct spek_pipeline_stats stats = this->pipeline ? spek_pipeline_get_stats(this->pipeline) : this->stats;
+    std::string text = spek_pipeline_format_stats(stats);
+    std::vector<wxString> lines;
+    if (this->pass_level == PREVIEW_LEVEL) {
+        lines.push_back("Preview");
+    } else {
+        lines.push_back(wxString::Format("Level %d", this->pass_level));
+    }
+    for (size_t pos = 0, end; pos < text.size(); pos = end + 2) {
+        end = std::min(text.find("; ", pos), text.size());
+        lines.push_back(wxString::FromUTF8(text.substr(pos, end - pos).c_str()));
+    }
+    lines.push_back(wxString::Format(
+        "GUI: events %.2f s, paint %.2f s", this->event_time * 1e-9, this->paint_time * 1e-9
+    ));
+
+    dc.SetFont(this->small_font);
+    int line_height = dc.GetTextExtent("dummy").GetHeight();
+    int width = 0;
+    for (const auto& line : lines) {
+        width = spek_max(width, dc.GetTextExtent(line).GetWidth());
+    }
+    this->stats_rect = wxRect(LPAD, TPAD, width + 2 * GAP, (int)lines.size() * line_height + 2 * GAP);
+    dc.SetPen(*wxBLACK_PEN);
+    dc.SetBrush(*wxBLACK_BRUSH);
+    dc.DrawRectangle(
+        this->stats_rect.x, this->stats_rect.y, this->stats_rect.width, this->stats_rect.height
+    );
+    dc.SetTextForeground(wxColour(255, 255, 255));
+    for (size_t i = 0; i < lines.size(); ++i) {
+        dc.DrawText(lines[i], LPAD + GAP, TPAD + GAP + (int)i * line_height);
+    }
 }
 
 void SpekSpectrogram::on_size(wxSizeEvent&)
 {
+    // Columns are scaled to the window, the analysis is only refined once it's too coarse.
+    // Resizing repaints everything anyway, the frame is rebuilt at the new size.
     wxSize size = GetClientSize();
-    bool width_changed = this->prev_width != size.GetWidth();
-    this->prev_width = size.GetWidth();
-
-    if (width_changed) {
-        start();
+    int width = size.GetWidth() - LPAD - RPAD;
+    if (width <= 0) {
+        return;
+    }
+    if (!this->store || analysis_columns(width) > this->store->get_columns(0) ||
+        analysis_rows(this->scale, this->fft_bits, size.GetHeight() - TPAD - BPAD) != this->wanted_rows) {
+        start(true);
+    } else {
+        update_view(true);
+        refine();
     }
 }
 
 void SpekSpectrogram::on_have_sample(SpekHaveSampleEvent& event)
 {
-    int bands = event.get_bands();
-    int sample = event.get_sample();
-    const float *values = event.get_values();
+    if (event.get_generation() != this->generation) {
+        return;
+    }
+    int64_t start = spek_now();
 
-    if (sample == -1) {
+    // Draw everything that's ready by now, including columns stored after the event was posted.
+    int level;
+    int64_t first, last, latest;
+    bool ready = this->store && this->store->take_ready(&level, &first, &last, &latest);
+    if (!ready && this->preview && this->preview->take_ready(&level, &first, &last, &latest)) {
+        // Each column of the preview is stretched over PREVIEW_STEP of level 0.
+        ready = true;
+        first *= PREVIEW_STEP;
+        last *= PREVIEW_STEP;
+    }
+    if (ready) {
+        // Columns of other levels show through where the visible level is missing.
+        if (level <= this->view_level) {
+            first <<= this->view_level - level;
+            last <<= this->view_level - level;
+        } else {
+            first >>= level - this->view_level;
+            last = ((last - 1) >> (level - this->view_level)) + 1;
+        }
+        int width = this->images[0].GetWidth();
+        int x0 = (int)spek_max64(0, first - this->view_first);
+        int x1 = (int)spek_min64(width, last - this->view_first);
+
+        std::lock_guard<std::mutex> lock(this->store->get_mutex());
+        for (int c = 0; c < this->store->get_channels(); ++c) {
+            compose(c, x0, x1);
+        }
+        if (!device.IsEmpty()) {
+            // The images are rings, live input scrolls by moving where they start on screen.
+            this->scroll = (latest + 1) % width;
+            x0 = 0;
+            x1 = width;
+        }
+
+        // Only the new columns are scaled into the frame and repainted.
+        if (x0 < x1) {
+            if (this->dirty_first < this->dirty_last) {
+                x0 = spek_min(x0, this->dirty_first);
+                x1 = spek_max(x1, this->dirty_last);
+            }
+            this->dirty_first = x0;
+            this->dirty_last = x1;
+            wxRect rect = columns_rect(x0, x1);
+            if (!rect.IsEmpty()) {
+                RefreshRect(rect, false);
+            }
+        }
+    }
+    if (this->show_stats) {
+        // The numbers change width, they all fit into the same lines.
+        wxRect rect(0, this->stats_rect.y, GetClientSize().GetWidth(), this->stats_rect.height);
+        RefreshRect(rect, false);
+    }
+    this->event_time += spek_now() - start;
+
+    if (event.is_done()) {
         this->stop();
+        if (this->pass_level == PREVIEW_LEVEL) {
+            // Now the overview, it replaces the preview as it comes in.
+            run_pass(0, 0, this->store->get_columns(0));
+            for (int c = 0; c < this->store->get_channels(); ++c) {
+                this->descs[c] = wxString::FromUTF8(spek_pipeline_desc(this->pipeline, c).c_str());
+            }
+            start_pass();
+            invalidate();
+            return;
+        }
+        if (this->pass_level == 0) {
+            this->preview.reset();
+            save_cache();
+        }
+        refine(true);
+    }
+}
+
+void SpekSpectrogram::zoom(int key)
+{
+    if (!this->store || !this->device.IsEmpty()) {
         return;
     }
 
-    // TODO: check image size, quit if wrong.
-    double range = this->urange - this->lrange;
-    for (int y = 0; y < bands; y++) {
-        double value = fmin(this->urange, fmax(this->lrange, values[y]));
-        double level = (value - this->lrange) / range;
-        uint32_t color = spek_palette(this->palette, level);
-        int draw_sample = sample;
-        if (!device.IsEmpty()) {
-            draw_sample = sample % (this->image.GetWidth()-1);
+    // Down to one column of the finest level per pixel.
+    wxSize size = GetClientSize();
+    int width = size.GetWidth() - LPAD - RPAD;
+    double min_length = width / (double)this->store->get_columns(this->store->get_levels() - 1);
+    double centre = this->view_start + this->view_length / 2;
+    switch (key) {
+    case 'z':
+        this->view_length = fmax(fmin(1.0, min_length), this->view_length / 2);
+        break;
+    case 'Z':
+        this->view_length = fmin(1.0, this->view_length * 2);
+        break;
+    case WXK_LEFT:
+        centre -= this->view_length / 4;
+        break;
+    case WXK_RIGHT:
+        centre += this->view_length / 4;
+        break;
+    }
+    this->view_start = fmax(0.0, fmin(1.0 - this->view_length, centre - this->view_length / 2));
+
+    // Whatever is being refined may not be visible any more.
+    if (this->pipeline && this->pass_level > 0) {
+        stop();
+    }
+    update_view(true);
+    invalidate();
+    refine();
+}
+
+// Pick the coarsest level that has a column for each pixel and draw the visible part of it.
+void SpekSpectrogram::update_view(bool clear)
+{
+    if (!this->store) {
+        return;
+    }
+    wxSize size = GetClientSize();
+    int width = spek_max(1, size.GetWidth() - LPAD - RPAD);
+    int level = 0;
+    while (level + 1 < this->store->get_levels() &&
+        this->view_length * this->store->get_columns(level) < width) {
+        level++;
+    }
+    int64_t columns = this->store->get_columns(level);
+    int64_t first = (int64_t)floor(this->view_start * columns);
+    int64_t last = spek_min64(columns, (int64_t)ceil((this->view_start + this->view_length) * columns));
+    first = spek_min64(first, last - 1);
+    int bands = this->rows;
+    if (!clear && level == this->view_level && first == this->view_first &&
+        this->images[0].GetWidth() == last - first) {
+        return;
+    }
+
+    this->view_level = level;
+    this->view_first = first;
+    for (auto& image : this->images) {
+        if (clear || image.GetWidth() <= 1) {
+            image.Create(last - first, bands);
+        } else {
+            // The old result stays on screen until new columns replace it.
+            image = image.Scale(last - first, bands);
         }
-        if (draw_sample >= 0 && draw_sample < this->image.GetWidth()) {
-            this->image.SetRGB(
-                draw_sample,
-                bands - y - 1,
-                color >> 16,
-                (color >> 8) & 0xFF,
-                color & 0xFF
-            );
+    }
+    std::lock_guard<std::mutex> lock(this->store->get_mutex());
+    for (int c = 0; c < this->store->get_channels(); ++c) {
+        compose(c, 0, last - first);
+    }
+    this->frame_dirty = true;
+}
+
+// Fill in the missing part of the view, unless something is running already.
+// Columns a finished pass didn't deliver are past the end of the file, don't go after them again.
+void SpekSpectrogram::refine(bool after_pass)
+{
+    if (!this->store || this->pipeline || this->view_level == 0) {
+        return;
+    }
+    int64_t first, last;
+    int64_t end = this->view_first + this->images[0].GetWidth();
+    if (!this->store->find_missing(this->view_level, this->view_first, end, &first, &last)) {
+        return;
+    }
+    if (after_pass && this->pass_level == this->view_level &&
+        first >= this->pass_first && last <= this->pass_last) {
+        return;
+    }
+    run_pass(this->view_level, first, last);
+}
+
+// Colour `count` columns starting at `x`, each of `values` holds `bands` dB values or is NULL
+// to leave the column as it is. The image is row-major, so columns are coloured a tile at
+// a time and written out row by row.
+void SpekSpectrogram::draw_columns(wxImage& image, int x, int count, const float *const *values)
+{
+    int bands = image.GetHeight();
+    int stride = image.GetWidth() * 3;
+    unsigned char *data = image.GetData();
+    this->column_colors.resize(DRAW_TILE * bands);
+    uint32_t *colors = this->column_colors.data();
+    for (int tile = 0; tile < count; tile += DRAW_TILE) {
+        int n = spek_min(DRAW_TILE, count - tile);
+        for (int i = 0; i < n; ++i) {
+            if (values[tile + i]) {
+                spek_palette_map(
+                    colors + i * bands, values[tile + i], bands,
+                    this->palette_lut.data(), this->lrange, this->urange
+                );
+            }
         }
-        if (!device.IsEmpty()) {
-            draw_sample = (sample+1) % (this->image.GetWidth()-1);
-            this->image.SetRGB(
-                draw_sample,
-                bands - y - 1,
-                0xFF,
-                0xFF,
-                0xFF
-            );
+        // The top row of the image is the highest band.
+        for (int y = 0; y < bands; y++) {
+            unsigned char *pixel = data + (bands - y - 1) * stride + (x + tile) * 3;
+            for (int i = 0; i < n; ++i, pixel += 3) {
+                if (values[tile + i]) {
+                    uint32_t color = colors[i * bands + y];
+                    pixel[0] = color >> 16;
+                    pixel[1] = (color >> 8) & 0xFF;
+                    pixel[2] = color & 0xFF;
+                }
+            }
         }
     }
+}
+
+// Draw image columns [first, last) of the view from the finest level that has them, or from
+// the preview. Must be called with the store mutex held.
+void SpekSpectrogram::compose(int channel, int first, int last)
+{
+    std::unique_lock<std::mutex> preview_lock;
+    if (this->preview) {
+        preview_lock = std::unique_lock<std::mutex>(this->preview->get_mutex());
+    }
+    std::vector<const float*> values(spek_max(0, last - first));
+    for (int x = first; x < last; ++x) {
+        int64_t column = this->view_first + x;
+        const float *v = NULL;
+        for (int level = this->view_level; level >= 0 && !v; --level) {
+            v = this->store->get(level, channel, column >> (this->view_level - level));
+        }
+        if (!v && this->preview) {
+            v = this->preview->get(0, channel, (column >> this->view_level) / PREVIEW_STEP);
+        }
+        values[x - first] = v;
+    }
+    draw_columns(this->images[channel], first, last - first, values.data());
+}
 
-    // TODO: refresh only one pixel column
-    this->Refresh();
+void SpekSpectrogram::recolour()
+{
+    if (!this->store) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->store->get_mutex());
+    for (int c = 0; c < this->store->get_channels(); ++c) {
+        compose(c, 0, this->images[c].GetWidth());
+    }
 }
 
 static wxString time_formatter(int unit)
@@ -233,6 +667,12 @@ static wxString freq_formatter(int unit)
     return wxString::Format(_("%d kHz"), unit / 1000);
 }
 
+// Log and mel scales go below 1 kHz.
+static wxString scale_freq_formatter(int unit)
+{
+    return unit < 1000 ? wxString::Format(_("%d Hz"), unit) : freq_formatter(unit);
+}
+
 static wxString density_formatter(int unit)
 {
     return wxString::Format(_("%d dB"), -unit);
@@ -250,29 +690,18 @@ void SpekSpectrogram::render(wxDC& dc)
     dc.SetPen(*wxWHITE_PEN);
     dc.SetBrush(*wxTRANSPARENT_BRUSH);
     dc.SetTextForeground(wxColour(255, 255, 255));
-    wxFont normal_font = wxFont(
-        (int)round(9 * spek_platform_font_scale()),
-        wxFONTFAMILY_SWISS,
-        wxFONTSTYLE_NORMAL,
-        wxFONTWEIGHT_NORMAL
-    );
-    wxFont large_font = wxFont(normal_font);
-    large_font.SetPointSize((int)round(10 * spek_platform_font_scale()));
-    large_font.SetWeight(wxFONTWEIGHT_BOLD);
-    wxFont small_font = wxFont(normal_font);
-    small_font.SetPointSize((int)round(8 * spek_platform_font_scale()));
-    dc.SetFont(normal_font);
+    dc.SetFont(this->normal_font);
     int normal_height = dc.GetTextExtent("dummy").GetHeight();
-    dc.SetFont(large_font);
+    dc.SetFont(this->large_font);
     int large_height = dc.GetTextExtent("dummy").GetHeight();
-    dc.SetFont(small_font);
+    dc.SetFont(this->small_font);
     int small_height = dc.GetTextExtent("dummy").GetHeight();
 
     // Clean the background.
     dc.Clear();
 
     // Spek version
-    dc.SetFont(large_font);
+    dc.SetFont(this->large_font);
     wxString package_name(PACKAGE_NAME);
     dc.DrawText(
         package_name,
@@ -280,40 +709,49 @@ void SpekSpectrogram::render(wxDC& dc)
         TPAD - 2 * GAP - normal_height - large_height
     );
     int package_name_width = dc.GetTextExtent(package_name + " ").GetWidth();
-    dc.SetFont(small_font);
+    dc.SetFont(this->small_font);
     dc.DrawText(
         PACKAGE_VERSION,
         w - RPAD + GAP + package_name_width,
         TPAD - 2 * GAP - normal_height - small_height
     );
 
-    if (this->image.GetWidth() > 1 && this->image.GetHeight() > 1 &&
+    const wxImage& image = this->images[this->channel];
+    if (image.GetWidth() > 1 && image.GetHeight() > 1 &&
         w - LPAD - RPAD > 0 && h - TPAD - BPAD > 0) {
         // Draw the spectrogram.
-        wxBitmap bmp(this->image.Scale(w - LPAD - RPAD, h - TPAD - BPAD));
-        dc.DrawBitmap(bmp, LPAD, TPAD);
+        draw_view(dc, 0, image.GetWidth());
 
         // File name.
-        dc.SetFont(large_font);
+        dc.SetFont(this->large_font);
         dc.DrawText(
             trim(dc, this->path, w - LPAD - RPAD, false),
             LPAD,
             TPAD - 2 * GAP - normal_height - large_height
         );
 
-        // File properties.
-        dc.SetFont(normal_font);
+        // File properties, and the spectrum shown unless it's the average.
+        wxString desc = this->descs[this->channel];
+        if (this->spectrum == SPECTRUM_MAX) {
+            desc += ", S:Max";
+        } else if (this->spectrum == SPECTRUM_MIN) {
+            desc += ", S:Min";
+        }
+        dc.SetFont(this->normal_font);
         dc.DrawText(
-            trim(dc, this->desc, w - LPAD - RPAD, true),
+            trim(dc, desc, w - LPAD - RPAD, true),
             LPAD,
             TPAD - GAP - normal_height
         );
 
         // Prepare to draw the rulers.
-        dc.SetFont(small_font);
+        dc.SetFont(this->small_font);
 
         if (this->duration) {
-            // Time ruler.
+            // Time ruler, only for the part of the file in view.
+            double start_time = this->view_start * this->duration;
+            double end_time = start_time + this->view_length * this->duration;
+            double scale = (w - LPAD - RPAD) / (end_time - start_time);
             int time_factors[] = {1, 2, 5, 10, 20, 30, 1*60, 2*60, 5*60, 10*60, 20*60, 30*60, 0};
             SpekRuler time_ruler(
                 LPAD,
@@ -322,17 +760,36 @@ void SpekSpectrogram::render(wxDC& dc)
                 // TODO: i18n
                 "00:00",
                 time_factors,
-                0,
-                (int)this->duration,
+                (int)ceil(start_time),
+                (int)end_time,
                 1.5,
-                (w - LPAD - RPAD) / this->duration,
-                0.0,
+                scale,
+                (ceil(start_time) - start_time) * scale,
                 time_formatter
                 );
             time_ruler.draw(dc);
         }
 
-        if (this->sample_rate) {
+        if (this->sample_rate && this->scale != SCALE_LINEAR) {
+            // Frequency ruler, the ticks can't be evenly spaced.
+            double max_freq = this->sample_rate / 2.0;
+            enum frequency_scale scale = this->scale;
+            int freq_ticks[] = {50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 0};
+            SpekScaleRuler freq_ruler(
+                LPAD,
+                TPAD,
+                SpekRuler::LEFT,
+                _("00 kHz"),
+                freq_ticks,
+                (int)ceil(spek_scale_freq(scale, 0.0, max_freq)),
+                this->sample_rate / 2,
+                1.5,
+                h - TPAD - BPAD,
+                [scale, max_freq](int unit) { return spek_scale_position(scale, unit, max_freq); },
+                scale_freq_formatter
+            );
+            freq_ruler.draw(dc);
+        } else if (this->sample_rate) {
             // Frequency ruler.
             int freq = this->sample_rate / 2;
             int freq_factors[] = {1000, 2000, 5000, 10000, 20000, 0};
@@ -363,7 +820,7 @@ void SpekSpectrogram::render(wxDC& dc)
         dc.DrawBitmap(bmp, w - RPAD + GAP, TPAD);
 
         // Prepare to draw the ruler.
-        dc.SetFont(small_font);
+        dc.SetFont(this->small_font);
 
         // Spectral density.
         int density_factors[] = {1, 2, 5, 10, 20, 50, 0};
@@ -385,14 +842,90 @@ void SpekSpectrogram::render(wxDC& dc)
     }
 }
 
-static void pipeline_cb(int bands, int sample, float *values, void *cb_data)
+// Where columns [first, last) of the image end up in the window.
+wxRect SpekSpectrogram::columns_rect(int first, int last)
 {
-    SpekHaveSampleEvent event(bands, sample, values, false);
-    SpekSpectrogram *s = (SpekSpectrogram *)cb_data;
-    wxPostEvent(s, event);
+    wxSize size = GetClientSize();
+    int w = size.GetWidth() - LPAD - RPAD;
+    int h = size.GetHeight() - TPAD - BPAD;
+    int width = this->images[this->channel].GetWidth();
+    if (w <= 0 || h <= 0 || width <= 1) {
+        return wxRect();
+    }
+    int x0 = (int)((int64_t)first * w / width);
+    int x1 = (int)(((int64_t)last * w + width - 1) / width);
+    return wxRect(LPAD + x0, TPAD, x1 - x0, h);
 }
 
-void SpekSpectrogram::start()
+// Scale columns [first, last) of the image into an already rendered frame.
+void SpekSpectrogram::render_columns(wxDC& dc, int first, int last)
+{
+    draw_view(dc, first, last);
+
+    // The border runs over the edges of the spectrogram.
+    wxSize size = GetClientSize();
+    dc.SetPen(*wxWHITE_PEN);
+    dc.SetBrush(*wxTRANSPARENT_BRUSH);
+    dc.DrawRectangle(LPAD, TPAD, size.GetWidth() - LPAD - RPAD, size.GetHeight() - TPAD - BPAD);
+}
+
+// Draw columns [first, last) of the image, scrolled live input is drawn as a whole.
+void SpekSpectrogram::draw_view(wxDC& dc, int first, int last)
+{
+    int width = this->images[this->channel].GetWidth();
+    if (this->scroll) {
+        draw_part(dc, this->scroll, width, 0);
+        draw_part(dc, 0, this->scroll, width - this->scroll);
+    } else {
+        draw_part(dc, first, last, first);
+    }
+}
+
+// Draw columns [first, last) of the image where column `x` goes in the window.
+void SpekSpectrogram::draw_part(wxDC& dc, int first, int last, int x)
+{
+    const wxImage& image = this->images[this->channel];
+    wxRect rect = columns_rect(x, x + last - first);
+    if (image.GetHeight() <= 1 || rect.IsEmpty()) {
+        return;
+    }
+    wxImage part = first == 0 && last == image.GetWidth() ?
+        image : image.GetSubImage(wxRect(first, 0, last - first, image.GetHeight()));
+    dc.DrawBitmap(wxBitmap(part.Scale(rect.width, rect.height)), rect.x, rect.y);
+}
+
+// Called from the pipeline threads, columns go straight into the store.
+void SpekSpectrogram::pipeline_cb(int bands, int channel, int sample, float *values, void *cb_data)
+{
+    SpekPass *pass = (SpekPass *)cb_data;
+    SpekSpectrogram *s = pass->spectrogram;
+    // Nobody is waiting for what a stopped pass still delivers.
+    if (pass->generation != s->generation) {
+        return;
+    }
+    if (sample == -1) {
+        SpekHaveSampleEvent event(true, pass->generation);
+        wxPostEvent(s, event);
+        return;
+    }
+
+    TileStore *store = pass->store.get();
+    int64_t column = sample;
+    if (pass->live) {
+        column = sample % store->get_columns(0);
+    }
+    // The pass only keeps the columns it was started for.
+    if (bands != store->get_bands() || column < pass->first || column >= pass->last) {
+        return;
+    }
+    // Only the first column since the GUI last looked needs an event, it picks up the rest too.
+    if (store->put(pass->level, channel, column, values)) {
+        SpekHaveSampleEvent event(false, pass->generation);
+        wxPostEvent(s, event);
+    }
+}
+
+void SpekSpectrogram::start(bool refine)
 {
     wxLogMessage("SpekSpectrogram::start");
     if (this->path.IsEmpty() && this->device.IsEmpty()) {
@@ -400,50 +933,300 @@ void SpekSpectrogram::start()
     }
 
     this->stop();
+    this->scroll = 0;
+    this->stats = spek_pipeline_stats();
+    this->event_time = 0;
+    this->paint_time = 0;
 
-    // The number of samples is the number of pixels available for the image.
+    // The number of samples doesn't depend on the exact number of pixels available for the
+    // image, so that resizing the window doesn't restart the analysis every time.
     // The number of bands is fixed, FFT results are very different for
     // different values but we need some consistency.
     wxSize size = GetClientSize();
-    int samples = size.GetWidth() - LPAD - RPAD;
-    if (samples > 0) {
-        this->image.Create(samples, bits_to_bands(this->fft_bits));
+    int width = size.GetWidth() - LPAD - RPAD;
+    if (width > 0) {
+        int samples = analysis_columns(width);
+        this->wanted_rows = analysis_rows(this->scale, this->fft_bits, size.GetHeight() - TPAD - BPAD);
+        this->rows = this->wanted_rows;
+        // The overview of a file that was analysed before comes straight from the cache.
+        this->cache_key = make_cache_key(samples);
+        auto entry = this->cache_key.empty() ? nullptr : this->cache->find(this->cache_key);
+        if (entry) {
+            const CacheInfo& info = entry->get_info();
+            // Saved with the rows that fit, see below.
+            int levels = zoom_levels(samples, info.duration, false);
+            if (info.bands != fit_rows(this->rows, info.channels, samples, levels) ||
+                info.columns != samples) {
+                entry.reset();
+            }
+        }
+        if (entry) {
+            const CacheInfo& info = entry->get_info();
+            this->streams = info.streams;
+            this->channels = info.channels;
+            this->duration = info.duration;
+            this->sample_rate = info.sample_rate;
+            this->pass_level = 0;
+            this->pass_first = 0;
+            this->pass_last = samples;
+        } else {
+            // Long files are skimmed first, so that the whole of it shows up within seconds.
+            run_pass(this->device.IsEmpty() ? PREVIEW_LEVEL : 0, 0, samples);
+            this->streams = spek_pipeline_streams(this->pipeline);
+            this->channels = spek_pipeline_channels(this->pipeline);
+            this->duration = spek_pipeline_duration(this->pipeline);
+            this->sample_rate = spek_pipeline_sample_rate(this->pipeline);
+            if (this->pass_level == PREVIEW_LEVEL && this->duration < MIN_PREVIEW_DURATION) {
+                stop();
+                run_pass(0, 0, samples);
+            }
+        }
+        if (!this->device.IsEmpty()) {
+            // Live input has no duration, the time ruler covers the columns on screen.
+            this->duration = samples * (double)(this->sample_rate * (int64_t)this->latency / 1000) /
+                spek_max(1, this->sample_rate);
+        }
+        if (this->channel >= this->channels) {
+            this->channel = 0;
+        }
+
+        // The store and the images must be there before the first column arrives.
+        int count = spek_max(1, this->channels);
+        int levels = zoom_levels(samples, this->duration, !this->device.IsEmpty());
+        this->rows = fit_rows(this->rows, count, samples, levels);
+        int bands = this->rows;
+        int64_t tile_size = (int64_t)count * TILE_COLUMNS * bands * sizeof(float);
+        int64_t level_tiles = (samples + TILE_COLUMNS - 1) / TILE_COLUMNS;
+        int max_tiles = (int)spek_max64(0, TILE_MEMORY / tile_size - level_tiles);
+        if (max_tiles < fine_tiles(samples)) {
+            // Not even the fewest rows leave room for zooming in.
+            levels = 1;
+        }
+        // When refining, the old result stays on screen until the new columns replace it.
+        bool keep = refine && (int)this->images.size() == count && this->images[0].GetHeight() == bands;
+        this->store.reset(new TileStore(count, bands, samples, levels, max_tiles));
+        this->preview.reset();
+        if (this->pass_level == PREVIEW_LEVEL) {
+            int columns = samples / PREVIEW_STEP;
+            this->preview.reset(new TileStore(count, bands, columns, 1, columns / TILE_COLUMNS + 1));
+        }
+        this->view_level = -1;
+        if (!keep) {
+            this->images.assign(count, wxImage(1, 1));
+        }
+        this->descs.resize(count);
+        if (entry) {
+            std::vector<float> column_values(bands);
+            for (int c = 0; c < count; ++c) {
+                for (int column = 0; column < samples; ++column) {
+                    if (entry->read(c, column, column_values.data())) {
+                        this->store->put(0, c, column, column_values.data());
+                    }
+                }
+                this->descs[c] = wxString::FromUTF8(entry->get_info().descs[c].c_str());
+            }
+            int level;
+            int64_t first, last, latest;
+            this->store->take_ready(&level, &first, &last, &latest);
+            update_view(!keep);
+            this->refine();
+        } else {
+            update_view(!keep);
+            for (int c = 0; c < count; ++c) {
+                // TODO: extract conversion into a utility function.
+                this->descs[c] = wxString::FromUTF8(spek_pipeline_desc(this->pipeline, c).c_str());
+            }
+            start_pass();
+        }
+    } else {
+        this->channel = 0;
+        this->images.assign(1, wxImage(1, 1));
+        this->store.reset();
+        this->descs.assign(1, wxEmptyString);
+    }
+
+    // New images, the frame has to be rendered again.
+    this->frame_dirty = true;
+}
+
+// Open a pipeline that fills columns [first, last) of `level`, it still has to be started.
+void SpekSpectrogram::run_pass(int level, int64_t first, int64_t last)
+{
+    // The preview has columns of its own, PREVIEW_STEP times wider than those of level 0.
+    if (level == PREVIEW_LEVEL) {
+        first /= PREVIEW_STEP;
+        last /= PREVIEW_STEP;
+    }
+    this->pass_level = level;
+    this->pass_first = first;
+    this->pass_last = last;
+    this->pass.reset(new SpekPass());
+    this->pass->spectrogram = this;
+    this->pass->generation = this->generation;
+    this->pass->level = spek_max(0, level);
+    this->pass->first = first;
+    this->pass->last = last;
+    this->pass->live = !this->device.IsEmpty();
+
+    // Each pass reads a copy of `file` that opens without probing, the pipelines stopped before
+    // keep theirs until they are closed and don't have to be waited for. A device may not be
+    // opened twice though, live input is only opened again once the last pipeline let go of it.
+    if (this->file && (!!this->file->get_error() || this->file_stream != this->stream)) {
+        this->file.reset();
+    }
+    if (!this->device.IsEmpty()) {
+        wait_closed();
+        this->file.reset();
+    }
+    if (!this->file) {
+        this->file = this->audio->open(
+            std::string(this->path.utf8_str()), std::string(this->device.utf8_str()), this->stream
+        );
+        this->file_stream = this->stream;
+    }
+    std::unique_ptr<AudioFile> file;
+    if (this->device.IsEmpty() && !this->file->get_error()) {
+        file = this->file->reopen();
+    }
+    if (!file) {
+        // The pipeline reports the error, or reads the only copy.
+        file = std::move(this->file);
+    }
+    if (!this->device.IsEmpty()) {
+        // Live input goes on until it's stopped, its columns wrap around the images.
+        this->pipeline = spek_pipeline_open_live(
+            std::move(file), this->fft.get(), this->fft_bits, 0, AUDIO_ALL_CHANNELS,
+            this->window_function, this->overlap, this->latency, pipeline_cb, this->pass.get()
+        );
+    } else {
         this->pipeline = spek_pipeline_open(
-            this->audio->open(std::string(this->path.utf8_str()), std::string(this->device.utf8_str()), this->stream),
-            this->fft->create(this->fft_bits),
+            std::move(file),
+            this->fft.get(),
+            this->fft_bits,
+            0,
             this->stream,
-            this->channel,
+            AUDIO_ALL_CHANNELS,
             this->window_function,
-            samples,
+            this->overlap,
+            level > 0 ? (int)this->store->get_columns(level) : (int)last,
+            (int)first,
+            (int)last,
             pipeline_cb,
-            this
+            this->pass.get()
         );
-        spek_pipeline_start(this->pipeline);
-        // TODO: extract conversion into a utility function.
-        this->desc = wxString::FromUTF8(spek_pipeline_desc(this->pipeline).c_str());
-        this->streams = spek_pipeline_streams(this->pipeline);
-        this->channels = spek_pipeline_channels(this->pipeline);
-        this->duration = spek_pipeline_duration(this->pipeline);
-        this->sample_rate = spek_pipeline_sample_rate(this->pipeline);
-    } else {
-        this->image.Create(1, 1);
     }
+    if (level == PREVIEW_LEVEL) {
+        spek_pipeline_set_sparse(this->pipeline, true);
+    }
+    spek_pipeline_set_spectra(this->pipeline, 1 << this->spectrum);
+    if (level > 0) {
+        start_pass();
+    }
+}
+
+// The store must be there before the first column arrives, and `rows` settled.
+void SpekSpectrogram::start_pass()
+{
+    // Bands are folded on a linear scale too when there are more than fit into TILE_MEMORY.
+    int sample_rate = spek_pipeline_sample_rate(this->pipeline);
+    if (this->rows != bits_to_bands(this->fft_bits) && sample_rate > 0) {
+        spek_pipeline_set_band_map(
+            this->pipeline,
+            BandMap::get(this->scale, bits_to_bands(this->fft_bits), sample_rate, this->rows)
+        );
+    }
+    this->pass->store = this->pass_level == PREVIEW_LEVEL ? this->preview : this->store;
+    spek_pipeline_start(this->pipeline);
+}
+
+// Files are told apart by their size and modification time, everything that changes the
+// columns goes into the key too. Empty for live input, which is never cached.
+std::string SpekSpectrogram::make_cache_key(int samples)
+{
+    wxFileName file_name(this->path);
+    if (!this->device.IsEmpty() || !file_name.FileExists()) {
+        return std::string();
+    }
+    wxString key = wxString::Format(
+        "%s\n%s\n%s\n%lld\n%d %d %d %d %d %d %d %d",
+        PACKAGE_VERSION,
+        file_name.GetFullPath(),
+        file_name.GetSize().ToString(),
+        (long long)file_name.GetModificationTime().GetValue().GetValue(),
+        this->stream,
+        this->fft_bits,
+        (int)this->window_function,
+        this->overlap,
+        samples,
+        (int)this->scale,
+        this->wanted_rows,
+        (int)this->spectrum
+    );
+    return std::string(key.utf8_str());
+}
+
+// Keep the overview of a finished file for the next time it's opened.
+void SpekSpectrogram::save_cache()
+{
+    if (this->cache_key.empty() || !this->store) {
+        return;
+    }
+    CacheInfo info;
+    info.channels = this->store->get_channels();
+    info.bands = this->store->get_bands();
+    info.columns = this->store->get_columns(0);
+    info.streams = this->streams;
+    info.sample_rate = this->sample_rate;
+    info.duration = this->duration;
+    for (int c = 0; c < info.channels; ++c) {
+        info.descs.push_back(std::string(this->descs[c].utf8_str()));
+    }
+    TileStore *store = this->store.get();
+    std::lock_guard<std::mutex> lock(store->get_mutex());
+    this->cache->save(this->cache_key, info, CACHE_BITS, [store](int channel, int column) {
+        return store->get(0, channel, column);
+    });
 }
 
+// Returns right away, the pipeline is closed in the background along with its file. Whatever
+// it still delivers is dropped, the pass it belongs to is not the current generation any more.
 void SpekSpectrogram::stop()
 {
     wxLogMessage("SpekSpectrogram::stop");
     if (this->pipeline) {
-        spek_pipeline_close(this->pipeline);
+        this->stats = spek_pipeline_get_stats(this->pipeline);
+        this->generation++;
+        spek_pipeline_cancel(this->pipeline);
+        spek_pipeline *pipeline = this->pipeline;
+        SpekPass *pass = this->pass.release();
+        {
+            std::lock_guard<std::mutex> lock(this->closer_mutex);
+            this->closers++;
+        }
+        std::thread([this, pipeline, pass] {
+            spek_pipeline_close(pipeline);
+            delete pass;
+            std::lock_guard<std::mutex> lock(this->closer_mutex);
+            this->closers--;
+            this->closer_cond.notify_all();
+        }).detach();
         this->pipeline = NULL;
-
-        // Make sure all have_sample events are processed before returning.
-        wxApp::GetInstance()->ProcessPendingEvents();
     }
 }
 
+// Cancelled pipelines close quickly, but what they hold on to is only waited for when it has to
+// be: by the destructor, and for a device before it's opened again.
+void SpekSpectrogram::wait_closed()
+{
+    std::unique_lock<std::mutex> lock(this->closer_mutex);
+    this->closer_cond.wait(lock, [this] { return this->closers == 0; });
+}
+
 void SpekSpectrogram::create_palette()
 {
+    this->palette_lut.resize(PALETTE_LUT_SIZE);
+    spek_palette_lut(this->palette_lut.data(), this->palette);
+
     this->palette_image.Create(RULER, bits_to_bands(this->fft_bits));
     for (int y = 0; y < bits_to_bands(this->fft_bits); y++) {
         uint32_t color = spek_palette(this->palette, y / (double)bits_to_bands(this->fft_bits));
@@ -487,6 +1270,78 @@ static wxString trim(wxDC& dc, const wxString& s, int length, bool trim_end)
 }
 
 // TODO: test
+// The window width rounded up to a power of two, so that the analysis only has to be refined
+// when the window grows past it.
+static int analysis_columns(int width) {
+    int columns = MIN_COLUMNS;
+    while (columns < width) {
+        columns *= 2;
+    }
+    return columns;
+}
+
+// A linear scale shows every band. Others fold them into about as many rows as there are pixels,
+// with the same steps as the columns so that resizing doesn't start over every time.
+static int analysis_rows(enum frequency_scale scale, int bits, int height) {
+    int bands = bits_to_bands(bits);
+    if (scale == SCALE_LINEAR) {
+        return bands;
+    }
+    int rows = MIN_ROWS;
+    while (rows < height) {
+        rows *= 2;
+    }
+    return spek_min(rows, bands);
+}
+
+// Zoom in until there are enough columns per second, live input can't be zoomed.
+static int zoom_levels(int samples, double duration, bool live)
+{
+    int levels = 1;
+    while (!live && levels < MAX_LEVELS && ((int64_t)samples << levels) < INT32_MAX &&
+        ((int64_t)samples << (levels - 1)) < duration * MAX_COLUMNS_PER_SECOND) {
+        levels++;
+    }
+    return levels;
+}
+
+// Tiles of finer levels kept at least, enough for the view and the pass that refines it.
+static int fine_tiles(int samples)
+{
+    return 2 * samples / TILE_COLUMNS + 4;
+}
+
+// Halve the rows until level 0 and the fine tiles fit into TILE_MEMORY, down to MIN_ROWS.
+static int fit_rows(int rows, int channels, int samples, int levels)
+{
+    int64_t tiles = (samples + TILE_COLUMNS - 1) / TILE_COLUMNS + (levels > 1 ? fine_tiles(samples) : 0);
+    int64_t row_size = (int64_t)spek_max(1, channels) * TILE_COLUMNS * sizeof(float) * tiles;
+    while (rows > MIN_ROWS && rows * row_size > TILE_MEMORY) {
+        rows /= 2;
+    }
+    return rows;
+}
+
 static int bits_to_bands(int bits) {
     return (1 << (bits - 1)) + 1;
 }
+
+// Automatic overlap first, then more and more of it.
+static int next_overlap(int overlap, int step)
+{
+    static const int overlaps[] = {OVERLAP_AUTO, 0, 50, MAX_OVERLAP};
+    const int count = sizeof(overlaps) / sizeof(overlaps[0]);
+    int i = 0;
+    while (i < count && overlaps[i] != overlap) {
+        i++;
+    }
+    return overlaps[(i + step + count) % count];
+}
+
+// Next to the preferences.
+static std::string cache_dir()
+{
+    wxFileName dir(spek_platform_config_path("spek"));
+    dir.AppendDir("cache");
+    return std::string(dir.GetPath().utf8_str());
+}
@@ -1,15 +1,25 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <wx/wx.h>
 
 #include "spek-palette.h"
 #include "spek-pipeline.h"
+#include "spek-scale.h"
 
 class Audio;
+class AudioFile;
 class FFT;
+class SpectrumCache;
 class SpekHaveSampleEvent;
+class TileStore;
+struct SpekPass;
 struct spek_pipeline;
 
 class SpekSpectrogram : public wxWindow
@@ -18,6 +28,8 @@ public:
     SpekSpectrogram(wxFrame *parent);
     ~SpekSpectrogram();
     void open(const wxString& path, const wxString& device);
+    // Milliseconds of live input in each column.
+    void set_latency(int latency);
     void save(const wxString& path);
 
 private:
@@ -25,33 +37,91 @@ private:
     void on_paint(wxPaintEvent& evt);
     void on_size(wxSizeEvent& evt);
     void on_have_sample(SpekHaveSampleEvent& evt);
+    void invalidate();
     void render(wxDC& dc);
+    wxRect columns_rect(int first, int last);
+    void render_columns(wxDC& dc, int first, int last);
+    void draw_view(wxDC& dc, int first, int last);
+    void draw_part(wxDC& dc, int first, int last, int x);
+    void draw_columns(wxImage& image, int x, int count, const float *const *values);
+    void compose(int channel, int first, int last);
+    void recolour();
+    void zoom(int key);
+    void update_view(bool clear);
+    void refine(bool after_pass = false);
+    void draw_stats(wxDC& dc);
 
-    void start();
+    static void pipeline_cb(int bands, int channel, int sample, float *values, void *cb_data);
+
+    void start(bool refine = false);
+    void run_pass(int level, int64_t first, int64_t last);
+    void start_pass();
     void stop();
+    void wait_closed();
+    std::string make_cache_key(int samples);
+    void save_cache();
 
     void create_palette();
 
     std::unique_ptr<Audio> audio;
     std::unique_ptr<FFT> fft;
+    std::unique_ptr<SpectrumCache> cache;
+    std::string cache_key; // Of the overview being shown, empty if it can't be cached.
     spek_pipeline *pipeline;
+    std::unique_ptr<SpekPass> pass; // What the threads of `pipeline` deliver to.
+    std::atomic<int> generation; // Of the running pass, bumped whenever it's stopped.
+    std::mutex closer_mutex;
+    std::condition_variable closer_cond;
+    int closers; // Pipelines stopped and still being closed on threads of their own.
+    std::unique_ptr<AudioFile> file; // Never read, each pipeline gets a reopen() of it.
+    int file_stream; // Of `file`.
     int streams;
     int stream;
     int channels;
     int channel;
     enum window_function window_function;
+    int overlap; // Percent or OVERLAP_AUTO.
     wxString path;
     wxString device;
-    wxString desc;
+    int latency;
+    std::vector<wxString> descs; // One per channel.
     double duration;
     int sample_rate;
     enum palette palette;
     wxImage palette_image;
-    wxImage image;
-    int prev_width;
+    std::vector<uint32_t> palette_lut; // `palette` baked by spek_palette_lut().
+    std::vector<uint32_t> column_colors;
+    std::vector<wxImage> images; // One per channel, all of them are drawn in the same pass.
+    std::shared_ptr<TileStore> store; // dB values behind the images, at every zoom level.
+    std::shared_ptr<TileStore> preview; // Skimmed columns shown until level 0 is in.
     int fft_bits;
     int urange;
     int lrange;
+    enum frequency_scale scale;
+    int wanted_rows; // See analysis_rows().
+    int rows; // Of the images, fewer than `wanted_rows` if they wouldn't fit into TILE_MEMORY.
+    enum spectrum_type spectrum; // The one shown and analysed.
+
+    wxFont normal_font;
+    wxFont large_font;
+    wxFont small_font;
+    wxBitmap frame; // The last rendered window.
+    bool frame_dirty; // Render all of `frame` again.
+    int dirty_first; // Image columns to scale into `frame` before painting.
+    int dirty_last;
+    double view_start; // The part of the file in view, as fractions of its duration.
+    double view_length;
+    int view_level; // The images show columns [view_first, view_first + width) of this level.
+    int64_t view_first;
+    int pass_level; // Columns [pass_first, pass_last) of this level are being analysed.
+    int64_t pass_first;
+    int64_t pass_last;
+    int scroll; // Live input is a ring of columns, this is the oldest one.
+    bool show_stats; // Draw where the time of the pass goes over the spectrogram.
+    struct spek_pipeline_stats stats; // Of the last pipeline stopped.
+    int64_t event_time; // Nanoseconds spent in on_have_sample() since start().
+    int64_t paint_time; // And in on_paint().
+    wxRect stats_rect; // Where they were drawn last.
 
     DECLARE_EVENT_TABLE()
 };
@@ -0,0 +1,140 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "spek-tiles.h"
+
+// Tiles are keyed by level and index.
+static uint64_t tile_key(int level, int64_t column)
+{
+    return ((uint64_t)level << 56) | (uint64_t)(column / TILE_COLUMNS);
+}
+
+TileStore::TileStore(int channels, int bands, int columns, int levels, int max_tiles) :
+    channels(channels), bands(bands), columns(columns), levels(levels), max_tiles(max_tiles),
+    fine_tiles(0), clock(0), ready_level(0), ready_first(0), ready_last(0), latest(-1)
+{
+}
+
+const float *TileStore::get(int level, int channel, int64_t column)
+{
+    Tile *tile = this->find(level, column);
+    if (!tile) {
+        return NULL;
+    }
+    tile->used = ++this->clock;
+    const float *values = tile->values.data() +
+        ((size_t)channel * TILE_COLUMNS + column % TILE_COLUMNS) * this->bands;
+    return isnan(values[0]) ? NULL : values;
+}
+
+bool TileStore::put(int level, int channel, int64_t column, const float *values)
+{
+    assert(level >= 0 && level < this->levels);
+    assert(channel >= 0 && channel < this->channels);
+    assert(column >= 0 && column < this->get_columns(level));
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Tile *tile = this->find(level, column);
+    if (!tile) {
+        tile = this->create(level, column);
+    }
+    tile->used = ++this->clock;
+    float *dst = tile->values.data() +
+        ((size_t)channel * TILE_COLUMNS + column % TILE_COLUMNS) * this->bands;
+    if (isnan(dst[0])) {
+        tile->stored++;
+    }
+    memcpy(dst, values, this->bands * sizeof(float));
+
+    bool notify = this->ready_first >= this->ready_last;
+    if (notify || level != this->ready_level) {
+        // Only one level is being filled at a time, anything else replaces it.
+        this->ready_level = level;
+        this->ready_first = column;
+        this->ready_last = column + 1;
+    } else {
+        this->ready_first = column < this->ready_first ? column : this->ready_first;
+        this->ready_last = column + 1 > this->ready_last ? column + 1 : this->ready_last;
+    }
+    this->latest = column;
+    return notify;
+}
+
+bool TileStore::take_ready(int *level, int64_t *first, int64_t *last, int64_t *latest)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->ready_first >= this->ready_last) {
+        return false;
+    }
+    *level = this->ready_level;
+    *first = this->ready_first;
+    *last = this->ready_last;
+    *latest = this->latest;
+    this->ready_first = this->ready_last = 0;
+    return true;
+}
+
+bool TileStore::find_missing(
+    int level, int64_t first, int64_t last, int64_t *miss_first, int64_t *miss_last)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    *miss_first = last;
+    *miss_last = first;
+    for (int64_t column = first; column < last; ) {
+        int64_t end = (column / TILE_COLUMNS + 1) * TILE_COLUMNS;
+        end = end < last ? end : last;
+        Tile *tile = this->find(level, column);
+        bool full = tile && tile->stored == this->channels * TILE_COLUMNS;
+        for (int64_t c = column; c < end && !full; ++c) {
+            bool missing = !tile;
+            for (int ch = 0; ch < this->channels && !missing; ++ch) {
+                missing = isnan(tile->values[((size_t)ch * TILE_COLUMNS + c % TILE_COLUMNS) * this->bands]);
+            }
+            if (missing) {
+                *miss_first = c < *miss_first ? c : *miss_first;
+                *miss_last = c + 1;
+            }
+        }
+        column = end;
+    }
+    return *miss_first < *miss_last;
+}
+
+TileStore::Tile *TileStore::find(int level, int64_t column)
+{
+    auto it = this->tiles.find(tile_key(level, column));
+    return it == this->tiles.end() ? NULL : it->second.get();
+}
+
+TileStore::Tile *TileStore::create(int level, int64_t column)
+{
+    if (level > 0) {
+        if (this->fine_tiles >= this->max_tiles) {
+            this->evict();
+        }
+        this->fine_tiles++;
+    }
+    Tile *tile = new Tile();
+    tile->values.assign((size_t)this->channels * TILE_COLUMNS * this->bands, NAN);
+    tile->stored = 0;
+    tile->used = 0;
+    this->tiles[tile_key(level, column)].reset(tile);
+    return tile;
+}
+
+// Drop the least recently used tile of a level other than 0.
+void TileStore::evict()
+{
+    auto oldest = this->tiles.end();
+    for (auto it = this->tiles.begin(); it != this->tiles.end(); ++it) {
+        bool fine = it->first >> 56;
+        if (fine && (oldest == this->tiles.end() || it->second->used < oldest->second->used)) {
+            oldest = it;
+        }
+    }
+    if (oldest != this->tiles.end()) {
+        this->tiles.erase(oldest);
+        this->fine_tiles--;
+    }
+}
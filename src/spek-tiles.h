@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+enum {
+    TILE_COLUMNS = 256, // Columns of all channels kept together.
+};
+
+// Spectrogram columns of every channel at several resolutions, stored by the pipeline threads
+// and drawn by the client. Level 0 has `columns` columns across the whole file and each next
+// level has twice as many. Values are in dB, columns that haven't been stored are NAN.
+//
+// Memory is allocated a tile at a time. Level 0 is always kept, tiles of finer levels are
+// dropped least recently used first once there are more than `max_tiles` of them.
+class TileStore
+{
+public:
+    TileStore(int channels, int bands, int columns, int levels, int max_tiles);
+
+    int get_channels() const { return this->channels; }
+    int get_bands() const { return this->bands; }
+    int get_levels() const { return this->levels; }
+    int64_t get_columns(int level) const { return (int64_t)this->columns << level; }
+
+    // Hold the mutex while reading values, other columns may be stored at the same time.
+    std::mutex& get_mutex() { return this->mutex; }
+    // Returns NULL if the column hasn't been stored or was dropped since.
+    const float *get(int level, int channel, int64_t column);
+
+    // Copy a column in, returns true if nothing else was ready, i.e. the client has to be told.
+    bool put(int level, int channel, int64_t column, const float *values);
+    // Columns stored since the last call are within [first, last) of `level`, `latest` is the
+    // most recently stored one. Returns false if nothing was stored.
+    bool take_ready(int *level, int64_t *first, int64_t *last, int64_t *latest);
+    // The smallest range within [first, last) of `level` that holds each missing column.
+    // Returns false if all of them are there.
+    bool find_missing(int level, int64_t first, int64_t last, int64_t *miss_first, int64_t *miss_last);
+
+private:
+    struct Tile
+    {
+        std::vector<float> values; // All columns of channel 0, then channel 1 and so on.
+        int stored; // Columns of all channels stored so far.
+        uint64_t used; // Value of `clock` when the tile was last used.
+    };
+
+    Tile *find(int level, int64_t column);
+    Tile *create(int level, int64_t column);
+    void evict();
+
+    int channels;
+    int bands;
+    int columns;
+    int levels;
+    int max_tiles;
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::unique_ptr<Tile>> tiles;
+    int fine_tiles; // Tiles of levels other than 0.
+    uint64_t clock;
+    int ready_level;
+    int64_t ready_first;
+    int64_t ready_last;
+    int64_t latest;
+};
@@ -2,6 +2,8 @@
 #include <limits.h>
 #include <stdlib.h>
 
+#include <chrono>
+
 #include "spek-utils.h"
 
 int spek_vercmp(const char *a, const char *b)
@@ -45,3 +47,10 @@ int spek_vercmp(const char *a, const char *b)
         b = j + 1;
     }
 }
+
+int64_t spek_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 inline int spek_max(int a, int b)
 {
     return a > b ? a : b;
@@ -10,5 +12,18 @@ inline int spek_min(int a, int b)
     return a < b ? a : b;
 }
 
+inline int64_t spek_max64(int64_t a, int64_t b)
+{
+    return a > b ? a : b;
+}
+
+inline int64_t spek_min64(int64_t a, int64_t b)
+{
+    return a < b ? a : b;
+}
+
 // Compare version numbers, e.g. 1.9.2 < 1.10.0
 int spek_vercmp(const char *a, const char *b);
+
+// Nanoseconds of a monotonic clock, for timing how long things take.
+int64_t spek_now();
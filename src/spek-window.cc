@@ -51,7 +51,7 @@ private:
     SpekWindow *window;
 };
 
-SpekWindow::SpekWindow(const wxString& path, const wxString& device) :
+SpekWindow::SpekWindow(const wxString& path, const wxString& device, int latency) :
     wxFrame(NULL, -1, wxEmptyString, wxDefaultPosition, wxSize(640, 480)), path(path), device(device)
 {
     this->description = _("Spek - Acoustic Spectrum Analyser");
@@ -135,6 +135,7 @@ SpekWindow::SpekWindow(const wxString& path, const wxString& device) :
     sizer->Add(info_bar, 0, wxEXPAND);
 
     this->spectrogram = new SpekSpectrogram(this);
+    this->spectrogram->set_latency(latency);
     sizer->Add(this->spectrogram, 1, wxEXPAND);
 
     this->cur_dir = wxGetHomeDir();
@@ -246,7 +247,9 @@ void SpekWindow::on_save(wxCommandEvent&)
 
     if (filters.IsEmpty()) {
         filters = _("PNG images");
-        filters += "|*.png";
+        filters += "|*.png|";
+        filters += _("NumPy arrays");
+        filters += "|*.npy";
     }
 
     wxFileDialog *dlg = new wxFileDialog(
@@ -269,7 +272,11 @@ void SpekWindow::on_save(wxCommandEvent&)
 
     if (dlg->ShowModal() == wxID_OK) {
         this->cur_dir = dlg->GetDirectory();
-        this->spectrogram->save(dlg->GetPath());
+        wxFileName path(dlg->GetPath());
+        if (dlg->GetFilterIndex() == 1 && path.GetExt().Lower() != "npy") {
+            path.SetExt("npy");
+        }
+        this->spectrogram->save(path.GetFullPath());
     }
 
     dlg->Destroy();
@@ -7,7 +7,7 @@ class SpekSpectrogram;
 class SpekWindow : public wxFrame
 {
 public:
-    SpekWindow(const wxString& path, const wxString& device);
+    SpekWindow(const wxString& path, const wxString& device, int latency);
     void open(const wxString& path, const wxString& device);
 
 private:
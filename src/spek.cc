@@ -1,8 +1,11 @@
+#include <string.h>
+
 #include <wx/cmdline.h>
 #include <wx/log.h>
 #include <wx/socket.h>
 
 #include "spek-artwork.h"
+#include "spek-batch.h"
 #include "spek-platform.h"
 #include "spek-preferences.h"
 
@@ -11,7 +14,7 @@
 class Spek: public wxApp
 {
 public:
-    Spek() : wxApp(), window(NULL), quit(false) {}
+    Spek() : wxApp(), window(NULL), latency(50), quit(false) {}
 
 protected:
     virtual bool OnInit();
@@ -24,10 +27,23 @@ private:
     SpekWindow *window;
     wxString path;
     wxString device;
+    long latency;
     bool quit;
 };
 
-IMPLEMENT_APP(Spek)
+IMPLEMENT_APP_NO_MAIN(Spek)
+
+int main(int argc, char **argv)
+{
+    // Batch mode runs without a display, so it has to start before any of the GUI does.
+    // Everything after "--" is a file name.
+    for (int i = 1; i < argc && strcmp(argv[i], "--"); ++i) {
+        if (!strcmp(argv[i], "--batch")) {
+            return spek_batch(argc, argv);
+        }
+    }
+    return wxEntry(argc, argv);
+}
 
 bool Spek::OnInit()
 {
@@ -60,6 +76,13 @@ bool Spek::OnInit()
             "Show continuous graph recorded from mircophone",
             wxCMD_LINE_VAL_NONE,
             wxCMD_LINE_PARAM_OPTIONAL,
+        }, {
+            wxCMD_LINE_OPTION,
+            NULL,
+            "latency",
+            "Milliseconds of the recording in each column of the graph, 50 by default",
+            wxCMD_LINE_VAL_NUMBER,
+            wxCMD_LINE_PARAM_OPTIONAL,
         }, {
             wxCMD_LINE_PARAM,
             NULL,
@@ -90,11 +113,12 @@ bool Spek::OnInit()
     if (parser.Found("microphone")) {
         this->device = "default";
     }
+    parser.Found("latency", &this->latency);
     if (parser.GetParamCount()) {
         this->path = parser.GetParam();
     }
 
-    this->window = new SpekWindow(this->path, this->device);
+    this->window = new SpekWindow(this->path, this->device, this->latency);
     this->window->Show(true);
     SetTopWindow(this->window);
     return true;
@@ -1,12 +1,28 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "spek-audio.h"
+#include "spek-fft.h"
+#include "spek-pipeline.h"
 
 const char *SAMPLE_FILE = SAMPLES_DIR "/perf.wav";
 const int SAMPLE_RATE = 44100;
 const int SAMPLE_DURATION = 8 * 60; // 8 minutes
 const int SAMPLES = SAMPLE_RATE * SAMPLE_DURATION; // per channel
 
+// Same range as the 'w'/'W' keys in the spectrogram.
+const int MIN_FFT_BITS = 8;
+const int MAX_FFT_BITS = 14;
+const int COLUMNS = 1000; // a typical window width
+const int BLOCK_SIZE = 4096; // samples returned by each read() of the null decoder
+
 // Some of the tests will use a sample .wav file which is auto-generated if it doesn't exists.
 static void create_samples()
 {
@@ -39,24 +55,288 @@ static void create_samples()
     }
 }
 
+// A decoder that returns the same block of noise over and over without doing any work.
+class NullAudioFile : public AudioFile
+{
+public:
+    NullAudioFile() : buffer(BLOCK_SIZE), remaining(0),
+        frames_per_interval(0), error_per_interval(0), error_base(0)
+    {
+        srand(93);
+        for (auto& value : this->buffer) {
+            value = rand() / static_cast<float>(RAND_MAX) * 2.0f - 1.0f;
+        }
+    }
+
+    std::unique_ptr<AudioFile> reopen() const override
+    {
+        return std::unique_ptr<AudioFile>(new NullAudioFile());
+    }
+
+    bool rewind() override
+    {
+        this->remaining = SAMPLES;
+        return true;
+    }
+
+    // Reads never block.
+    void interrupt() override {}
+
+    void start(int, int samples) override
+    {
+        // AudioFileImpl::start() with the time base set to 1 / SAMPLE_RATE.
+        this->remaining = SAMPLES;
+        this->error_base = samples;
+        this->frames_per_interval = SAMPLES / samples;
+        this->error_per_interval = SAMPLES % samples;
+    }
+
+    void start_live(int, int frames) override
+    {
+        this->remaining = SAMPLES;
+        this->error_base = 1;
+        this->frames_per_interval = frames;
+        this->error_per_interval = 0;
+    }
+
+    void seek(int64_t frame) override
+    {
+        this->remaining = SAMPLES - frame;
+    }
+
+    int read() override
+    {
+        int len = this->remaining < BLOCK_SIZE ? this->remaining : BLOCK_SIZE;
+        this->remaining -= len;
+        return len;
+    }
+
+    AudioError get_error() const override { return AudioError::OK; }
+    std::string get_codec_name() const override { return "null"; }
+    int get_bit_rate() const override { return 0; }
+    int get_sample_rate() const override { return SAMPLE_RATE; }
+    int get_bits_per_sample() const override { return 32; }
+    int get_streams() const override { return 1; }
+    int get_channels() const override { return 1; }
+    double get_duration() const override { return SAMPLE_DURATION; }
+    const float *get_plane(int) const override { return this->buffer.data(); }
+    int64_t get_frames_per_interval() const override { return this->frames_per_interval; }
+    int64_t get_error_per_interval() const override { return this->error_per_interval; }
+    int64_t get_error_base() const override { return this->error_base; }
+    AudioTimes get_times() const override { return AudioTimes(); }
+
+private:
+    std::vector<float> buffer;
+    int remaining;
+    int64_t frames_per_interval;
+    int64_t error_per_interval;
+    int64_t error_base;
+};
+
+// An FFT plan that leaves the output untouched.
+class NullFFTPlan : public FFTPlan
+{
+public:
+    NullFFTPlan(int nbits, int batch) : FFTPlan(nbits, batch) {}
+    void execute_many(int) override {}
+};
+
+class NullFFT : public FFT
+{
+public:
+    std::unique_ptr<FFTPlan> create(int nbits, int batch) override
+    {
+        return std::unique_ptr<FFTPlan>(new NullFFTPlan(nbits, batch));
+    }
+};
+
+static const char *window_name(enum window_function f)
+{
+    switch (f) {
+    case WINDOW_HANN:
+        return "hann";
+    case WINDOW_HAMMING:
+        return "hamming";
+    case WINDOW_BLACKMAN_HARRIS:
+        return "blackman-harris";
+    default:
+        return "-";
+    }
+}
+
+// One tab-separated line per measurement, so that runs of different builds can be diffed.
+static void report(
+    const std::string& stage, int fft_bits, const char *window, int64_t samples, double seconds)
+{
+    std::cout << stage << '\t';
+    if (fft_bits) {
+        std::cout << (1 << fft_bits);
+    } else {
+        std::cout << '-';
+    }
+    std::cout << '\t' << window << '\t' << samples << '\t' << seconds << '\t'
+        << static_cast<int64_t>(seconds > 0.0 ? samples / seconds : 0.0) << std::endl;
+}
+
+class Timer
+{
+public:
+    Timer() : start(std::chrono::steady_clock::now()) {}
+
+    double elapsed() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+struct PipelineRun
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+};
+
+static void pipeline_cb(int, int, int sample, float *, void *cb_data)
+{
+    if (sample != -1) {
+        return;
+    }
+
+    PipelineRun *run = static_cast<PipelineRun*>(cb_data);
+    std::lock_guard<std::mutex> lock(run->mutex);
+    run->done = true;
+    run->cond.notify_one();
+}
+
+// Time a full run from spek_pipeline_open() to the final callback.
+static double run_pipeline(
+    std::unique_ptr<AudioFile> file, FFT *fft, int fft_bits, enum window_function window_function,
+    unsigned spectra = 1 << SPECTRUM_MEAN)
+{
+    PipelineRun run;
+    Timer timer;
+    spek_pipeline *pipeline = spek_pipeline_open(
+        std::move(file), fft, fft_bits, 0, 0, 0, window_function, 0, COLUMNS, 0, COLUMNS, pipeline_cb, &run
+    );
+    spek_pipeline_set_spectra(pipeline, spectra);
+    spek_pipeline_start(pipeline);
+    {
+        std::unique_lock<std::mutex> lock(run.mutex);
+        run.cond.wait(lock, [&run] { return run.done; });
+    }
+    spek_pipeline_close(pipeline);
+    return timer.elapsed();
+}
+
 // Reading and decoding an audio file.
 static void perf_decoder()
 {
+    Audio audio;
+    auto file = audio.open(SAMPLE_FILE, "", 0);
+    file->start(0, COLUMNS);
+
+    Timer timer;
+    int64_t samples = 0;
+    int len;
+    while ((len = file->read()) > 0) {
+        samples += len;
+    }
+    report("decoder", 0, "-", samples, timer.elapsed());
+}
+
+// The FFT backends on their own, one window per call and a batch of them, as large as the
+// pipeline makes it for backends on another device.
+static void perf_fft()
+{
+    for (const auto& backend : FFT::get_backends()) {
+        FFT fft(backend);
+        for (int bits = MIN_FFT_BITS; bits <= MAX_FFT_BITS; ++bits) {
+            int batch = std::max(8, fft.get_batch_frames() >> bits);
+            auto plan = fft.create(bits, batch);
+            int n = plan->get_input_size();
+            int64_t windows = SAMPLES / n / batch * batch;
+            for (int count : {1, batch}) {
+                Timer timer;
+                for (int64_t i = 0; i < windows; i += count) {
+                    for (int k = 0; k < count; ++k) {
+                        float *input = plan->get_window_input(k);
+                        for (int j = 0; j < n; ++j) {
+                            input[j] = j & 1 ? 1.0f : -1.0f;
+                        }
+                    }
+                    plan->execute_many(count);
+                }
+                std::string stage = "fft-" + backend + (count > 1 ? "-batch" : "");
+                report(stage, bits, "-", windows * n, timer.elapsed());
+            }
+        }
+    }
 }
 
 // Running FFTs and processing the results.
 static void perf_worker()
 {
+    FFT fft;
+    for (int bits = MIN_FFT_BITS; bits <= MAX_FFT_BITS; ++bits) {
+        for (int f = 0; f < WINDOW_COUNT; ++f) {
+            auto window_function = static_cast<enum window_function>(f);
+            double seconds = run_pipeline(
+                std::unique_ptr<AudioFile>(new NullAudioFile()), &fft, bits, window_function
+            );
+            report("worker", bits, window_name(window_function), SAMPLES, seconds);
+        }
+        // The peak and the floor are accumulated in the same loop as the average.
+        double seconds = run_pipeline(
+            std::unique_ptr<AudioFile>(new NullAudioFile()), &fft, bits, WINDOW_DEFAULT,
+            (1 << SPECTRUM_COUNT) - 1
+        );
+        report("worker-spectra", bits, window_name(WINDOW_DEFAULT), SAMPLES, seconds);
+    }
+
+    // Against the backends that run on another device, the copies to it and back included.
+    for (const auto& backend : FFT::get_backends()) {
+        FFT device(backend);
+        if (!device.get_batch_frames()) {
+            continue;
+        }
+        for (int bits = MIN_FFT_BITS; bits <= MAX_FFT_BITS; ++bits) {
+            double seconds = run_pipeline(
+                std::unique_ptr<AudioFile>(new NullAudioFile()), &device, bits, WINDOW_DEFAULT
+            );
+            report("worker-" + backend, bits, window_name(WINDOW_DEFAULT), SAMPLES, seconds);
+        }
+    }
 }
 
 // Managing worker and decoder threads (in isolation from the actual decoder and worker).
 static void perf_pipeline()
 {
+    NullFFT fft;
+    for (int bits = MIN_FFT_BITS; bits <= MAX_FFT_BITS; ++bits) {
+        double seconds = run_pipeline(
+            std::unique_ptr<AudioFile>(new NullAudioFile()), &fft, bits, WINDOW_DEFAULT
+        );
+        report("pipeline", bits, window_name(WINDOW_DEFAULT), SAMPLES, seconds);
+    }
 }
 
 // Testing it all together.
 static void perf_all()
 {
+    Audio audio;
+    FFT fft;
+    for (int bits = MIN_FFT_BITS; bits <= MAX_FFT_BITS; ++bits) {
+        for (int f = 0; f < WINDOW_COUNT; ++f) {
+            auto window_function = static_cast<enum window_function>(f);
+            double seconds = run_pipeline(
+                audio.open(SAMPLE_FILE, "", 0), &fft, bits, window_function
+            );
+            report("all", bits, window_name(window_function), SAMPLES, seconds);
+        }
+    }
 }
 
 // Performance regression tests.
@@ -64,7 +344,9 @@ int main()
 {
     create_samples();
 
+    std::cout << "# stage\tfft_size\twindow\tsamples\tseconds\tsamples_per_second" << std::endl;
     perf_decoder();
+    perf_fft();
     perf_worker();
     perf_pipeline();
     perf_all();
@@ -1,4 +1,5 @@
 #include <map>
+#include <vector>
 
 #include "spek-audio.h"
 
@@ -31,14 +32,18 @@ static void test_info(AudioFile *file, const FileInfo& info)
 
 static void test_read(AudioFile *file, int samples)
 {
+    file->start(AUDIO_ALL_CHANNELS, 1);
+
     int samples_read = 0;
     double power = 0.0;
     int len;
     while ((len = file->read()) > 0) {
-        samples_read += len;
-        for (int i = 0; i < len; ++i) {
-            float level = file->get_buffer()[i];
-            power += level * level;
+        for (int c = 0; c < file->get_channels(); ++c) {
+            samples_read += len;
+            for (int i = 0; i < len; ++i) {
+                float level = file->get_plane(c)[i];
+                power += level * level;
+            }
         }
     }
 
@@ -48,11 +53,63 @@ static void test_read(AudioFile *file, int samples)
         power /= samples_read;
         test("error", 0, len);
         test("power", 0.0, power);
+        AudioTimes times = file->get_times();
+        // Plain PCM may come straight from a file mapping, with nothing to demux or decode.
+        bool pcm = !file->get_codec_name().compare(0, 3, "PCM");
+        test("timed", true, (times.demux > 0 && times.decode > 0) || (pcm && times.convert > 0));
     } else {
         test("error", -1, len);
     }
 }
 
+// Seeking into the middle leaves the other half to read.
+static void test_seek(AudioFile *file, int samples)
+{
+    int frames = samples / file->get_channels();
+    file->start(AUDIO_ALL_CHANNELS, 1);
+    file->seek(frames / 2);
+
+    int frames_read = 0;
+    int len;
+    while ((len = file->read()) > 0) {
+        frames_read += len;
+    }
+
+    test("frames", frames - frames / 2, frames_read);
+    test("error", 0, len);
+}
+
+static int read_frames(AudioFile *file)
+{
+    int frames = 0;
+    int len;
+    while ((len = file->read()) > 0) {
+        frames += len;
+    }
+    return frames;
+}
+
+// Once read to the end the same file can be started and read again.
+static void test_rewind(AudioFile *file, int samples)
+{
+    int frames = samples / file->get_channels();
+    file->start(AUDIO_ALL_CHANNELS, 1);
+    test("first", frames, read_frames(file));
+    test("rewind", true, file->rewind());
+    file->start(0, 1);
+    test("second", frames, read_frames(file));
+}
+
+// Opened again without probing, the stream is the same.
+static void test_reopen(AudioFile *file, const FileInfo& info)
+{
+    auto copy = file->reopen();
+    test("reopen", true, copy != nullptr);
+    test_info(copy.get(), info);
+    copy->start(AUDIO_ALL_CHANNELS, 1);
+    test("frames", info.samples / info.channels, read_frames(copy.get()));
+}
+
 void test_audio()
 {
     const double MP3_T = 5.0 * 1152 / 44100; // 5 frames * duration per mp3 frame
@@ -107,7 +164,7 @@ void test_audio()
     for (const auto& item : files) {
         auto name = item.first;
         auto info = item.second;
-        auto file = audio.open(SAMPLES_DIR "/" + name, 0);
+        auto file = audio.open(SAMPLES_DIR "/" + name, "", 0);
         run(
             "audio info: " + name,
             [&] () { test_info(file.get(), info); }
@@ -117,4 +174,24 @@ void test_audio()
             [&] () { test_read(file.get(), info.samples); }
         );
     }
+
+    // Lossless formats, every sample can be reached exactly.
+    std::vector<std::string> seekable = {
+        "1ch-96000Hz-24bps.flac", "2ch-48000Hz-16bps.flac", "2ch-44100Hz-16bps.wav",
+    };
+    for (const auto& name : seekable) {
+        auto file = audio.open(SAMPLES_DIR "/" + name, "", 0);
+        run(
+            "audio seek: " + name,
+            [&] () { test_seek(file.get(), files[name].samples); }
+        );
+        run(
+            "audio rewind: " + name,
+            [&] () { test_rewind(file.get(), files[name].samples); }
+        );
+        run(
+            "audio reopen: " + name,
+            [&] () { test_reopen(file.get(), files[name]); }
+        );
+    }
 }
@@ -0,0 +1,78 @@
+#include <stdio.h>
+
+#include <vector>
+
+#include "spek-cache.h"
+
+#include "test.h"
+
+static const char *CACHE_DIR = "test-cache";
+
+static CacheInfo make_info()
+{
+    CacheInfo info;
+    info.channels = 2;
+    info.bands = 3;
+    info.columns = 4;
+    info.streams = 1;
+    info.sample_rate = 44100;
+    info.duration = 12.5;
+    info.descs = {"left", "right"};
+    return info;
+}
+
+static void test_roundtrip(int bits, float tolerance)
+{
+    SpectrumCache cache(CACHE_DIR, 1 << 20);
+    CacheInfo info = make_info();
+    std::vector<float> values = {-10.0f, -55.5f, -INFINITY};
+    auto get = [&values](int channel, int column) -> const float * {
+        return channel == 1 && column == 2 ? NULL : values.data();
+    };
+    test("not cached", true, cache.find("key") == nullptr);
+    test("save", true, cache.save("key", info, bits, get));
+    test("other key", true, cache.find("other") == nullptr);
+
+    auto entry = cache.find("key");
+    test("found", true, entry != nullptr);
+    if (!entry) {
+        return;
+    }
+    const CacheInfo& found = entry->get_info();
+    test("channels", 2, found.channels);
+    test("bands", 3, found.bands);
+    test("columns", 4, found.columns);
+    test("sample rate", 44100, found.sample_rate);
+    test("duration", 12.5, found.duration);
+    test("descs", std::string("right"), found.descs[1]);
+
+    float column[3];
+    test("missing column", false, entry->read(1, 2, column));
+    test("stored column", true, entry->read(0, 2, column));
+    test("first value", true, std::abs(column[0] + 10.0f) < tolerance);
+    test("second value", true, std::abs(column[1] + 55.5f) < tolerance);
+    test("silence", true, column[2] < -150.0f);
+    cache.clear();
+}
+
+static void test_eviction()
+{
+    CacheInfo info = make_info();
+    std::vector<float> values(3, -20.0f);
+    auto get = [&values](int, int) -> const float * { return values.data(); };
+    // Room for one file only.
+    SpectrumCache cache(CACHE_DIR, 100);
+    test("save first", true, cache.save("first", info, 16, get));
+    test("save second", true, cache.save("second", info, 16, get));
+    test("first evicted", true, cache.find("first") == nullptr);
+    test("second kept", true, cache.find("second") != nullptr);
+    cache.clear();
+    remove(CACHE_DIR);
+}
+
+void test_cache()
+{
+    run("cache 16 bits", [] { test_roundtrip(16, 0.01f); });
+    run("cache 8 bits", [] { test_roundtrip(8, 0.5f); });
+    run("cache eviction", test_eviction);
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
 #include "spek-fft.h"
 
 #include "test.h"
@@ -6,9 +10,10 @@
 static const int FFT_BITS_MIN = 4;
 static const int FFT_BITS_MAX = 15;
 
-static void test_const()
+static void test_const(const std::string& backend)
 {
-    FFT fft;
+    FFT fft(backend);
+    test("backend", backend, fft.get_backend());
     for (int nbits = FFT_BITS_MIN; nbits <= FFT_BITS_MAX; ++nbits) {
         auto plan = fft.create(nbits);
         test("input size", 1 << nbits, plan->get_input_size());
@@ -45,9 +50,9 @@ static void test_const()
     }
 }
 
-static void test_sine()
+static void test_sine(const std::string& backend)
 {
-    FFT fft;
+    FFT fft(backend);
     for (int nbits = FFT_BITS_MIN; nbits <= FFT_BITS_MAX; ++nbits) {
         auto plan = fft.create(nbits);
         int n = plan->get_input_size();
@@ -72,8 +77,77 @@ static void test_sine()
     }
 }
 
+// Power of random input against a DFT in double precision.
+static void test_accuracy(const std::string& backend)
+{
+    FFT fft(backend);
+    srand(93);
+    for (int nbits = FFT_BITS_MIN; nbits <= 10; ++nbits) {
+        auto plan = fft.create(nbits);
+        plan->set_power_output(true);
+        int n = plan->get_input_size();
+        std::vector<double> input(n);
+        for (int i = 0; i < n; ++i) {
+            input[i] = rand() / (double)RAND_MAX * 2.0 - 1.0;
+            plan->set_input(i, input[i]);
+        }
+        plan->execute();
+        double max_error = 0.0;
+        for (int k = 0; k < plan->get_output_size(); ++k) {
+            double re = 0.0, im = 0.0;
+            for (int i = 0; i < n; ++i) {
+                re += input[i] * cos(2.0 * M_PI * k * i / n);
+                im -= input[i] * sin(2.0 * M_PI * k * i / n);
+            }
+            double expected = (re * re + im * im) / ((double)n * n);
+            max_error = std::max(max_error, std::abs(plan->get_output(k) - expected));
+        }
+        // Relative to the mean power of a bin, 1 / (3 n).
+        test("accuracy", true, max_error * 3.0 * n < 1e-4);
+    }
+}
+
+// Windows of a batch come out the same as one at a time.
+static void test_batch(const std::string& backend)
+{
+    FFT fft(backend);
+    const int batch = 3;
+    for (int nbits = FFT_BITS_MIN; nbits <= 12; nbits += 4) {
+        auto single = fft.create(nbits);
+        auto plan = fft.create(nbits, batch);
+        test("batch", batch, plan->get_batch());
+        int n = plan->get_input_size();
+        srand(nbits);
+        for (int k = 0; k < batch; ++k) {
+            test("aligned", (uintptr_t)0, (uintptr_t)plan->get_window_input(k) % 64);
+            for (int i = 0; i < n; ++i) {
+                plan->get_window_input(k)[i] = rand() / (float)RAND_MAX;
+            }
+        }
+        std::vector<float> inputs(plan->get_window_input(0), plan->get_window_input(0) + batch * n);
+        plan->execute_many(batch);
+        bool same = true;
+        for (int k = 0; k < batch; ++k) {
+            for (int i = 0; i < n; ++i) {
+                single->set_input(i, inputs[k * n + i]);
+            }
+            single->execute();
+            for (int i = 0; i < plan->get_output_size(); ++i) {
+                same = same && plan->get_window_output(k)[i] == single->get_output(i);
+            }
+        }
+        test("same output", true, same);
+    }
+}
+
 void test_fft()
 {
-    run("fft const", test_const);
-    run("fft sine", test_sine);
+    test("default backend", FFT::get_backends()[0], FFT().get_backend());
+    test("unknown backend", FFT::get_backends()[0], FFT("none").get_backend());
+    for (const auto& backend : FFT::get_backends()) {
+        run("fft const " + backend, [backend] { test_const(backend); });
+        run("fft sine " + backend, [backend] { test_sine(backend); });
+        run("fft accuracy " + backend, [backend] { test_accuracy(backend); });
+        run("fft batch " + backend, [backend] { test_batch(backend); });
+    }
 }
@@ -0,0 +1,42 @@
+#include <limits>
+
+#include "spek-palette.h"
+
+#include "test.h"
+
+static void test_lut()
+{
+    uint32_t lut[PALETTE_LUT_SIZE];
+    for (int p = 0; p < PALETTE_COUNT; ++p) {
+        auto palette = static_cast<enum palette>(p);
+        spek_palette_lut(lut, palette);
+        test("lowest level", spek_palette(palette, 0.0), lut[0]);
+        test("highest level", spek_palette(palette, 1.0), lut[PALETTE_LUT_SIZE - 1]);
+    }
+}
+
+static void test_map()
+{
+    uint32_t lut[PALETTE_LUT_SIZE];
+    spek_palette_lut(lut, PALETTE_MONO);
+
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    // Enough values to go through both the vector and the scalar paths.
+    const float values[] = {-120.0f, -60.0f, 0.0f, -200.0f, 10.0f, -inf, nan, -30.0f, -90.0f};
+    const uint32_t expected[] = {
+        0x000000, 0x808080, 0xFFFFFF, 0x000000, 0xFFFFFF, 0x000000, 0x000000, 0xBFBFBF, 0x404040
+    };
+    const int n = sizeof(values) / sizeof(values[0]);
+    uint32_t out[n];
+    spek_palette_map(out, values, n, lut, -120.0f, 0.0f);
+    for (int i = 0; i < n; ++i) {
+        test("mapped colour " + std::to_string(i), expected[i], out[i]);
+    }
+}
+
+void test_palette()
+{
+    run("palette lut", test_lut);
+    run("palette map", test_map);
+}
@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "spek-audio.h"
+#include "spek-pcm.h"
+
+#include "test.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+static void put_id(Bytes& out, const char *id)
+{
+    out.insert(out.end(), id, id + 4);
+}
+
+static void put_le(Bytes& out, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+static void put_be(Bytes& out, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+// A RIFF header with an odd sized chunk before the samples, `data_size` may lie.
+static Bytes wav(int tag, int channels, int bits, const Bytes& data, uint32_t data_size)
+{
+    Bytes out;
+    put_id(out, "RIFF");
+    put_le(out, 0, 4);
+    put_id(out, "WAVE");
+    put_id(out, "fmt ");
+    put_le(out, 16, 4);
+    put_le(out, tag, 2);
+    put_le(out, channels, 2);
+    put_le(out, 44100, 4);
+    put_le(out, 44100 * channels * bits / 8, 4);
+    put_le(out, channels * bits / 8, 2);
+    put_le(out, bits, 2);
+    put_id(out, "junk");
+    put_le(out, 3, 4);
+    out.insert(out.end(), 4, 0);
+    put_id(out, "data");
+    put_le(out, data_size, 4);
+    out.insert(out.end(), data.begin(), data.end());
+    return out;
+}
+
+// 48 kHz, `compression` makes it AIFF-C.
+static Bytes aiff(const char *compression, int channels, uint32_t frames, int bits, const Bytes& data)
+{
+    Bytes comm;
+    put_be(comm, channels, 2);
+    put_be(comm, frames, 4);
+    put_be(comm, bits, 2);
+    put_be(comm, 16383 + 15, 2);
+    put_be(comm, (uint64_t)48000 << 48, 8);
+    if (compression) {
+        put_id(comm, compression);
+        put_be(comm, 0, 2);
+    }
+
+    Bytes out;
+    put_id(out, "FORM");
+    put_be(out, 0, 4);
+    put_id(out, compression ? "AIFC" : "AIFF");
+    put_id(out, "COMM");
+    put_be(out, comm.size(), 4);
+    out.insert(out.end(), comm.begin(), comm.end());
+    put_id(out, "SSND");
+    put_be(out, 8 + data.size(), 4);
+    put_be(out, 0, 4);
+    put_be(out, 0, 4);
+    out.insert(out.end(), data.begin(), data.end());
+    return out;
+}
+
+static bool parse(const Bytes& bytes, PcmFormat *format)
+{
+    return spek_pcm_parse(bytes.data(), bytes.size(), format);
+}
+
+static void test_parse_wav()
+{
+    Bytes bytes(1 << 16);
+    FILE *file = fopen(SAMPLES_DIR "/2ch-44100Hz-16bps.wav", "rb");
+    bytes.resize(file ? fread(bytes.data(), 1, bytes.size(), file) : 0);
+    if (file) {
+        fclose(file);
+    }
+    PcmFormat format;
+    test("sample", true, spek_pcm_parse(bytes.data(), bytes.size(), &format));
+    test("channels", 2, format.channels);
+    test("sample rate", 44100, format.sample_rate);
+    test("bits", 16, format.bits);
+    test("bytes", 2, format.bytes);
+    test("float", false, format.is_float);
+    test("frames", (int64_t)4410, format.frames);
+
+    Bytes data(2 * 3 * 3);
+    test("24-bit", true, parse(wav(1, 2, 24, data, data.size()), &format));
+    test("24-bit bytes", 3, format.bytes);
+    test("24-bit frames", (int64_t)3, format.frames);
+    test("padded chunk", (uint64_t)56, format.offset);
+    test("float", true, parse(wav(3, 1, 32, Bytes(8), 8), &format) && format.is_float);
+    test("truncated", true, parse(wav(1, 2, 16, Bytes(10), 1000), &format));
+    test("truncated frames", (int64_t)2, format.frames);
+    test("streamed", true, parse(wav(1, 1, 16, Bytes(10), 0xFFFFFFFF), &format));
+    test("streamed frames", (int64_t)5, format.frames);
+    test("8-bit", false, parse(wav(1, 1, 8, Bytes(4), 4), &format));
+    test("compressed", false, parse(wav(0x55, 2, 16, Bytes(4), 4), &format));
+    test("no header", false, parse(Bytes(100), &format));
+}
+
+static void test_parse_aiff()
+{
+    PcmFormat format;
+    test("aiff", true, parse(aiff(nullptr, 2, 3, 16, Bytes(2 * 2 * 4)), &format));
+    test("channels", 2, format.channels);
+    test("sample rate", 48000, format.sample_rate);
+    test("big endian", true, format.big_endian);
+    test("frames from COMM", (int64_t)3, format.frames);
+    test("20-bit", true, parse(aiff(nullptr, 1, 10, 20, Bytes(3 * 2)), &format));
+    test("20-bit bytes", 3, format.bytes);
+    test("frames from SSND", (int64_t)2, format.frames);
+    test("aifc", true, parse(aiff("NONE", 1, 1, 16, Bytes(2)), &format) && format.big_endian);
+    test("sowt", true, parse(aiff("sowt", 1, 1, 16, Bytes(2)), &format) && !format.big_endian);
+    test("compressed", false, parse(aiff("ima4", 1, 1, 16, Bytes(2)), &format));
+}
+
+static void write_file(const char *path, const Bytes& bytes)
+{
+    FILE *file = fopen(path, "wb");
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+}
+
+// The file is read without FFmpeg and comes out as it would from it.
+static void test_read_pcm()
+{
+    const char *path = "test-pcm.wav";
+    Bytes data;
+    for (int value : {16384, -16384, 32767, -32768, 1, 0}) {
+        put_le(data, (uint16_t)value, 2);
+    }
+    write_file(path, wav(1, 2, 16, data, data.size()));
+    Audio audio;
+    auto file = audio.open(path, "", 0);
+    test("error", AudioError::OK, file->get_error());
+    test("codec", std::string("PCM signed 16-bit little-endian"), file->get_codec_name());
+    test("duration", 3.0 / 44100, file->get_duration());
+    file->start(AUDIO_ALL_CHANNELS, 1);
+    test("frames", 3, file->read());
+    test("left", true, std::abs(file->get_plane(0)[0] - 16384 / 32767.0) < 1e-6);
+    test("right", true, std::abs(file->get_plane(1)[1] + 32768 / 32767.0) < 1e-6);
+    test("end", 0, file->read());
+    auto copy = file->reopen();
+    copy->start(1, 1);
+    copy->seek(1);
+    test("seek", 2, copy->read());
+    test("seek value", true, std::abs(copy->get_plane(0)[0] + 32768 / 32767.0) < 1e-6);
+    remove(path);
+
+    path = "test-pcm.aiff";
+    data.clear();
+    for (int value : {0x400000, -0x800000}) {
+        put_be(data, (uint32_t)value, 3);
+    }
+    write_file(path, aiff(nullptr, 1, 2, 24, data));
+    file = audio.open(path, "", 0);
+    test("codec", std::string("PCM signed 24-bit big-endian"), file->get_codec_name());
+    file->start(0, 1);
+    test("frames", 2, file->read());
+    test("24-bit", true, std::abs(file->get_plane(0)[0] - 0.5) < 1e-6);
+    test("24-bit negative", true, std::abs(file->get_plane(0)[1] + 1.0) < 1e-6);
+    remove(path);
+}
+
+void test_pcm()
+{
+    run("pcm parse wav", test_parse_wav);
+    run("pcm parse aiff", test_parse_aiff);
+    run("pcm read", test_read_pcm);
+}
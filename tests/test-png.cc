@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <wx/image.h>
+
+#include "spek-png.h"
+
+#include "test.h"
+
+static uint32_t get_uint32(const unsigned char *data)
+{
+    return (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+// Bit by bit, not the way PngChunkStream does it.
+static uint32_t crc32(const unsigned char *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; ++k) {
+            crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+// Noise doesn't compress, one of its rows is then more than an IDAT chunk holds.
+static std::vector<unsigned char> make_pixels(int width, int height, bool noise)
+{
+    std::vector<unsigned char> pixels((size_t)width * height * 3);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        state = state * 1664525u + 1013904223u;
+        pixels[i] = noise ? state >> 24 : (i * 7) & 0xFF;
+    }
+    return pixels;
+}
+
+static void test_image(const std::string& name, int width, int height, bool noise, bool multiple_chunks)
+{
+    const char *path = "test-png.png";
+    std::vector<unsigned char> pixels = make_pixels(width, height, noise);
+    {
+        PngWriter png(path, width, height);
+        bool ok = true;
+        for (int y = 0; y < height; ++y) {
+            ok = png.write_row(&pixels[(size_t)y * width * 3]) && ok;
+        }
+        test(name + " rows", true, ok);
+        test(name + " finish", true, png.finish());
+    }
+
+    FILE *in = fopen(path, "rb");
+    std::vector<unsigned char> data;
+    unsigned char buffer[4096];
+    size_t size;
+    while (in && (size = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        data.insert(data.end(), buffer, buffer + size);
+    }
+    if (in) {
+        fclose(in);
+    }
+    std::string signature(data.begin(), data.begin() + std::min(data.size(), (size_t)8));
+    test(name + " signature", std::string("\x89PNG\r\n\x1a\n", 8), signature);
+
+    std::vector<std::string> types;
+    bool crcs = true;
+    bool header = false;
+    size_t offset = 8;
+    while (offset + 12 <= data.size()) {
+        uint32_t length = get_uint32(&data[offset]);
+        if (offset + 12 + length > data.size()) {
+            break;
+        }
+        const unsigned char *chunk = &data[offset + 4];
+        types.push_back(std::string(chunk, chunk + 4));
+        crcs = crcs && crc32(chunk, 4 + length) == get_uint32(chunk + 4 + length);
+        if (types.back() == "IHDR" && length == 13) {
+            const unsigned char *fields = chunk + 4;
+            header = get_uint32(fields) == (uint32_t)width && get_uint32(fields + 4) == (uint32_t)height &&
+                fields[8] == 8 && fields[9] == 2 && !fields[10] && !fields[11] && !fields[12];
+        }
+        offset += 12 + length;
+    }
+    test(name + " whole chunks", data.size(), offset);
+    test(name + " crcs", true, crcs);
+    test(name + " ihdr first", std::string("IHDR"), types.empty() ? std::string() : types.front());
+    test(name + " ihdr fields", true, header);
+    test(name + " iend last", std::string("IEND"), types.empty() ? std::string() : types.back());
+    int idats = 0;
+    for (const auto& type : types) {
+        idats += type == "IDAT";
+    }
+    test(name + " idat chunks", true, multiple_chunks ? idats > 1 : idats == 1);
+
+    if (!wxImage::FindHandler(wxBITMAP_TYPE_PNG)) {
+        wxImage::AddHandler(new wxPNGHandler());
+    }
+    wxImage image;
+    test(name + " load", true, image.LoadFile(path, wxBITMAP_TYPE_PNG));
+    remove(path);
+    if (!image.IsOk()) {
+        return;
+    }
+    test(name + " width", width, image.GetWidth());
+    test(name + " height", height, image.GetHeight());
+    test(name + " pixels", true, std::equal(pixels.begin(), pixels.end(), image.GetData()));
+}
+
+void test_png()
+{
+    run("png small", [] { test_image("small", 5, 3, false, false); });
+    run("png several chunks", [] { test_image("wide", 22000, 4, true, true); });
+}
@@ -0,0 +1,73 @@
+#include <vector>
+
+#include "spek-scale.h"
+
+#include "test.h"
+
+static void test_position()
+{
+    for (int s = 0; s < SCALE_COUNT; ++s) {
+        auto scale = (enum frequency_scale)s;
+        double bottom = scale == SCALE_LOG ? (double)MIN_LOG_FREQ : 0.0;
+        test("bottom", 0.0, spek_scale_position(scale, bottom, 22050.0));
+        test("top", 1.0, spek_scale_position(scale, 22050.0, 22050.0));
+        bool inverse = true;
+        bool rising = true;
+        double last = -1.0;
+        for (double position = 0.0; position <= 1.0; position += 0.125) {
+            double freq = spek_scale_freq(scale, position, 22050.0);
+            inverse = inverse && std::abs(spek_scale_position(scale, freq, 22050.0) - position) < 1e-9;
+            rising = rising && freq > last;
+            last = freq;
+        }
+        test("inverse", true, inverse);
+        test("rising", true, rising);
+    }
+    test("linear", 0.5, spek_scale_position(SCALE_LINEAR, 11025.0, 22050.0));
+    test("mel", 1000.0, spek_scale_freq(SCALE_MEL, spek_scale_position(SCALE_MEL, 1000.0, 8000.0), 8000.0));
+    test("log below", 0.0, spek_scale_position(SCALE_LOG, 5.0, 22050.0));
+}
+
+static void test_band_map()
+{
+    const int bands = 1025;
+    const int sample_rate = 44100;
+    for (int s = 0; s < SCALE_COUNT; ++s) {
+        for (int rows : {64, 700, 4000}) {
+            auto map = BandMap::get((enum frequency_scale)s, bands, sample_rate, rows);
+            test("rows", rows, map->get_rows());
+            test("bands", bands, map->get_bands());
+
+            // Every row is an average, a flat spectrum stays flat.
+            std::vector<float> in(bands, 2.0f);
+            std::vector<float> out(rows);
+            map->apply(out.data(), in.data());
+            bool flat = true;
+            for (float value : out) {
+                flat = flat && std::abs(value - 2.0f) < 1e-5f;
+            }
+            test("flat", true, flat);
+
+            // A single band shows up in the rows around its frequency and nowhere else.
+            int band = 300;
+            in.assign(bands, 0.0f);
+            in[band] = 1.0f;
+            map->apply(out.data(), in.data());
+            double freq = band * (sample_rate / 2.0) / (bands - 1);
+            int row = (int)(spek_scale_position((enum frequency_scale)s, freq, sample_rate / 2.0) * rows);
+            int spread = rows / bands + 2;
+            bool local = out[row] > 0.0f;
+            for (int i = 0; i < rows; ++i) {
+                local = local && (std::abs(i - row) <= spread || out[i] == 0.0f);
+            }
+            test("local", true, local);
+        }
+    }
+    test("shared", BandMap::get(SCALE_MEL, 513, 48000, 100), BandMap::get(SCALE_MEL, 513, 48000, 100));
+}
+
+void test_scale()
+{
+    run("scale position", test_position);
+    run("scale band map", test_band_map);
+}
@@ -0,0 +1,86 @@
+#include <vector>
+
+#include "spek-sink.h"
+
+#include "test.h"
+
+static void test_column_file()
+{
+    ColumnFile file(tmpfile(), 4 * sizeof(int));
+    const int a[] = {1, 2, 3, 4};
+    const int b[] = {5, 6, 7, 8};
+    test("write later record", true, file.write(3, b));
+    test("write earlier record", true, file.write(1, a));
+    int part[2] = {0, 0};
+    test("read part", true, file.read(3, sizeof(int), 2 * sizeof(int), part));
+    test("first value", 6, part[0]);
+    test("second value", 7, part[1]);
+    test("read record", true, file.read(1, 0, sizeof(int), part));
+    test("record value", 1, part[0]);
+    test("ok", true, file.is_ok());
+}
+
+static void test_raw_sink()
+{
+    const int bands = 3;
+    const char *path = "test-sink.raw";
+    {
+        RawSink sink(fopen(path, "w+b"), 2, bands, 10);
+        const float second[] = {1.0f, 2.0f, 3.0f};
+        const float first[] = {-1.0f, -2.0f, -3.0f};
+        sink.write(1, 12, second);
+        sink.write(0, 10, first);
+        sink.write(0, 5, first);
+        test("finish", true, sink.finish());
+    }
+
+    std::vector<float> values(3 * 2 * bands + 1);
+    FILE *in = fopen(path, "rb");
+    size_t count = fread(values.data(), sizeof(float), values.size(), in);
+    fclose(in);
+    remove(path);
+    test("whole columns", (size_t)(3 * 2 * bands), count);
+    test("first column", -2.0f, values[1]);
+    test("hole in the first column", -INFINITY, values[bands]);
+    test("missing column", -INFINITY, values[2 * bands]);
+    test("last column", 3.0f, values[5 * bands + 2]);
+    test("hole in the last column", -INFINITY, values[4 * bands]);
+}
+
+static void test_npy_sink()
+{
+    const char *path = "test-sink.npy";
+    {
+        NpySink sink(fopen(path, "w+b"), 1, 2, 10, 3, SINK_FLOAT16);
+        const float values[] = {1.0f, -2.5f};
+        sink.write(0, 11, values);
+        // Past the end of the array.
+        sink.write(0, 13, values);
+        test("finish", true, sink.finish());
+    }
+
+    FILE *in = fopen(path, "rb");
+    std::vector<unsigned char> data(4096);
+    data.resize(fread(data.data(), 1, data.size(), in));
+    fclose(in);
+    remove(path);
+    test("magic", std::string("\x93NUMPY", 6), std::string(data.begin(), data.begin() + 6));
+    size_t offset = 10 + (data[8] | data[9] << 8);
+    test("aligned", (size_t)0, offset % 64);
+    std::string header(data.begin() + 10, data.begin() + offset);
+    test("type", true, header.find("'descr': '<f2'") != std::string::npos);
+    test("shape", true, header.find("'shape': (3, 1, 2)") != std::string::npos);
+    test("size", offset + 3 * 2 * 2, data.size());
+    auto half = [&data, offset](int i) { return data[offset + i * 2] | data[offset + i * 2 + 1] << 8; };
+    test("missing column", 0xFC00, half(0));
+    test("one", 0x3C00, half(2));
+    test("negative", 0xC100, half(3));
+    test("last column", 0xFC00, half(5));
+}
+
+void test_sink()
+{
+    run("sink column file", test_column_file);
+    run("sink raw", test_raw_sink);
+    run("sink npy", test_npy_sink);
+}
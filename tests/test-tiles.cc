@@ -0,0 +1,67 @@
+#include "spek-tiles.h"
+
+#include "test.h"
+
+static void test_store()
+{
+    TileStore store(2, 3, 1000, 3, 4);
+    test("columns", (int64_t)4000, store.get_columns(2));
+    test("not stored", true, store.get(1, 1, 4) == NULL);
+
+    int level;
+    int64_t first, last, latest;
+    test("nothing ready", false, store.take_ready(&level, &first, &last, &latest));
+
+    const float values[] = {-10.0f, -20.0f, -30.0f};
+    test("first column notifies", true, store.put(1, 1, 4, values));
+    test("second column doesn't", false, store.put(1, 0, 2, values));
+    test("stored", -30.0f, store.get(1, 1, 4)[2]);
+    test("other channel", true, store.get(1, 0, 4) == NULL);
+    test("other level", true, store.get(0, 1, 4) == NULL);
+
+    test("ready", true, store.take_ready(&level, &first, &last, &latest));
+    test("ready level", 1, level);
+    test("first", (int64_t)2, first);
+    test("last", (int64_t)5, last);
+    test("latest", (int64_t)2, latest);
+    test("taken", false, store.take_ready(&level, &first, &last, &latest));
+    test("notifies again", true, store.put(1, 0, 9, values));
+}
+
+static void test_missing()
+{
+    TileStore store(1, 1, 1000, 2, 4);
+    const float value = -1.0f;
+    for (int64_t c = 0; c < 1000; ++c) {
+        if (c != 300 && c != 700) {
+            store.put(0, 0, c, &value);
+        }
+    }
+    int64_t first, last;
+    test("missing", true, store.find_missing(0, 0, 1000, &first, &last));
+    test("missing first", (int64_t)300, first);
+    test("missing last", (int64_t)701, last);
+    test("complete", false, store.find_missing(0, 400, 700, &first, &last));
+}
+
+static void test_evict()
+{
+    TileStore store(1, 1, 1000, 2, 2);
+    const float value = -1.0f;
+    store.put(0, 0, 0, &value);
+    store.put(1, 0, 0, &value);
+    store.put(1, 0, TILE_COLUMNS, &value);
+    store.get(1, 0, 0);
+    store.put(1, 0, 2 * TILE_COLUMNS, &value);
+    test("recently used tile kept", true, store.get(1, 0, 0) != NULL);
+    test("least recently used tile dropped", true, store.get(1, 0, TILE_COLUMNS) == NULL);
+    test("new tile", true, store.get(1, 0, 2 * TILE_COLUMNS) != NULL);
+    test("level 0 kept", true, store.get(0, 0, 0) != NULL);
+}
+
+void test_tiles()
+{
+    run("tile store", test_store);
+    run("tile store missing columns", test_missing);
+    run("tile store eviction", test_evict);
+}
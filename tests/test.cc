@@ -8,7 +8,14 @@ int main()
     std::cerr << "-------------" << std::endl;
 
     test_audio();
+    test_cache();
     test_fft();
+    test_palette();
+    test_pcm();
+    test_png();
+    test_scale();
+    test_sink();
+    test_tiles();
     test_utils();
 
     if (g_passes < g_total) {
@@ -34,5 +34,12 @@ template<class T> void test(const std::string& message, const T& expected, const
 }
 
 void test_audio();
+void test_cache();
 void test_fft();
+void test_palette();
+void test_pcm();
+void test_png();
+void test_scale();
+void test_sink();
+void test_tiles();
 void test_utils();